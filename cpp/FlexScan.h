@@ -17,8 +17,15 @@
 
 #pragma once
 
+#include "arena.h"
+#include "parallel.h"
+#include "profile.h"
 #include <boost/polygon/polygon.hpp>
 #include <algorithm>
+#include <iterator>
+#include <limits>
+#include <numeric>
+#include <queue>
 #include <type_traits>
 
 namespace FlexScan {
@@ -137,6 +144,7 @@ struct ScanlineEdge : Bases<ScanlineEdge<TEdge, Bases...>>... {
     using HighPrecision = typename bp::high_precision_type<Unit>::type;
 
     Edge* edge;
+    // Exact only while atEndpoint; stale for an edge passing through the scan (see Scan::scan)
     HighPrecision yIntercept = 0;
     bool atEndpoint = false;
     bool atPoint1 = false;
@@ -249,9 +257,354 @@ struct Scan {
         }
     };
 
-    // Split edges at intersections
+    // Pieces of edge between consecutive points. deltaWindingNumber flips like validate_scan
+    // flips it: when a piece runs backwards, or when a non-vertical edge snaps to a
+    // vertical piece.
+    template<typename OutIt>
+    static OutIt splitEdge(const Edge& edge, const ScanlineBasePoint* points, size_t numPoints, OutIt out)
+    {
+        typename ScanlineBase::less_point lessPoint;
+        auto p1 = toScanlineBasePoint(edge.point1);
+        auto p2 = toScanlineBasePoint(edge.point2);
+        bool forward = lessPoint(p1, p2);
+        bool vertical = x(p1) == x(p2);
+        for (size_t i = 0; i + 1 < numPoints; ++i) {
+            auto a = points[i];
+            auto b = points[i + 1];
+            Edge piece = edge;
+            if (lessPoint(a, b) != forward)
+                piece.deltaWindingNumber *= -1;
+            if (!vertical && x(a) == x(b))
+                piece.deltaWindingNumber *= -1;
+            if (lessPoint(b, a))
+                std::swap(a, b);
+            x(piece.point1, x(a));
+            y(piece.point1, y(a));
+            x(piece.point2, x(b));
+            y(piece.point2, y(b));
+            *out++ = piece;
+        }
+        return out;
+    }
+
+    // Split edges at intersections. dest may be the container holding [begin, end); the
+    // edges are then split in place.
+    //
+    // Snap rounding: endpoints and intersections (rounded down to the grid) are hot pixels,
+    // and every edge is split at each hot pixel it passes through. The predicates are
+    // boost's, so the result matches intersectEdgesBoost.
+    //
+    // This is bucketing, not a Bentley-Ottmann sweep. The y range is cut into bands; each band
+    // holds the part of every edge that lies within it, as an x range. Parts are sorted by x
+    // within a band and a pair is tested when its parts overlap. Each hot pixel is tested
+    // against the parts in its own band. The band height adapts to the edges (see below), so
+    // long diagonal or tall edges only meet the edges near them in each band. The worst case
+    // is still quadratic within a band: edges whose parts overlap in both x and y without
+    // crossing, e.g. long, nearly horizontal edges stacked closer than they rise, all get
+    // tested against each other (cam-bench --hatch).
+    //
+    // With a parallel policy, runs of bands go to worker threads. The output is identical
+    // for every thread count.
     template<typename Container, typename It>
-    static void intersectEdges(Container& dest, It begin, It end) {
+    static void intersectEdges(Container& dest, It begin, It end, const ExecutionPolicy& policy = defaultExecutionPolicy()) {
+        CAM_PROFILE_ZONE("intersectEdges");
+        using HalfEdge = typename ScanlineBase::half_edge;
+
+        struct Box {
+            ScanlineBasePoint low;
+            ScanlineBasePoint high;
+            Unit minY;
+            Unit maxY;
+            int index;
+        };
+
+        struct Split {
+            int index;
+            ScanlineBasePoint point;
+        };
+
+        size_t size = end - begin;
+        if (!size) {
+            dest.clear();
+            return;
+        }
+
+        // Boxes in validate_scan's order: by low point, then high point
+        ArenaVector<Box> boxes;
+        boxes.reserve(size);
+        long long sumHeight = 0;
+        Unit minY = std::numeric_limits<Unit>::max();
+        Unit maxY = std::numeric_limits<Unit>::min();
+        for (size_t i = 0; i < size; ++i) {
+            auto p1 = toScanlineBasePoint(begin[i].point1);
+            auto p2 = toScanlineBasePoint(begin[i].point2);
+            if (p2 < p1)
+                std::swap(p1, p2);
+            Unit y1 = std::min(y(p1), y(p2));
+            Unit y2 = std::max(y(p1), y(p2));
+            boxes.push_back({p1, p2, y1, y2, int(i)});
+            sumHeight += (long long)y2 - y1;
+            minY = std::min(minY, y1);
+            maxY = std::max(maxY, y2);
+        }
+        std::sort(boxes.begin(), boxes.end(), [](const Box& a, const Box& b) {
+            return a.low < b.low || a.low == b.low && (a.high < b.high || a.high == b.high && a.index < b.index);
+        });
+
+        // Band height: twice the median edge height, so most edges land in one or two bands, but
+        // no less than half the mean, so tall edges add at most about 2 copies per edge on average.
+        // At most one band per 4 edges.
+        long long range = (long long)maxY - minY + 1;
+        long long bandHeight;
+        {
+            ArenaVector<Unit> heights;
+            heights.reserve(size);
+            for (auto& box: boxes)
+                heights.push_back(box.maxY - box.minY);
+            std::nth_element(heights.begin(), heights.begin() + size / 2, heights.end());
+            bandHeight = std::max({2ll * heights[size / 2] + 1, sumHeight / (2 * (long long)size) + 1, range * 4 / (long long)size + 1});
+        }
+        long long numBands = (range + bandHeight - 1) / bandHeight;
+        auto bandOf = [minY, bandHeight](Unit yValue) { return size_t(((long long)yValue - minY) / bandHeight); };
+
+        // Each band holds the part of every edge within its y range, [bottom, bottom + bandHeight],
+        // as an x range widened by a unit for rounding. Ordered by that range's low x.
+        auto clip = [minY, bandHeight](const Box& box, size_t band, Unit& lowX, Unit& highX) {
+            lowX = x(box.low);
+            highX = x(box.high);
+            if (box.minY == box.maxY || x(box.low) == x(box.high))
+                return;
+            long long bottom = minY + (long long)band * bandHeight;
+            double y1 = (double)std::max<long long>(box.minY, bottom);
+            double y2 = (double)std::min<long long>(box.maxY, bottom + bandHeight);
+            double slope = ((double)x(box.high) - x(box.low)) / ((double)y(box.high) - y(box.low));
+            double x1 = x(box.low) + (y1 - y(box.low)) * slope;
+            double x2 = x(box.low) + (y2 - y(box.low)) * slope;
+            lowX = std::max(lowX, Unit(std::floor(std::min(x1, x2)) - 1));
+            highX = std::min(highX, Unit(std::ceil(std::max(x1, x2)) + 1));
+        };
+        struct Part {
+            int box;
+            Unit lowX;
+            Unit highX;
+        };
+        ArenaVector<ArenaVector<Part>> bands(numBands);
+        for (size_t i = 0; i < size; ++i) {
+            for (size_t b = bandOf(boxes[i].minY); b <= bandOf(boxes[i].maxY); ++b) {
+                Part part{int(i), 0, 0};
+                clip(boxes[i], b, part.lowX, part.highX);
+                bands[b].push_back(part);
+            }
+        }
+        for (auto& band: bands)
+            std::sort(band.begin(), band.end(), [](const Part& a, const Part& b) {
+                return a.lowX < b.lowX || a.lowX == b.lowX && a.box < b.box;
+            });
+
+        // Runs of bands with about equal numbers of edges. Run 0 appends hot pixels and splits to
+        // the shared vectors; each other run collects its own, appended after it in run order.
+        size_t numRuns = policy.parallel() ? std::min(bands.size(), size_t(policy.numThreads) * 4) : 1;
+        ArenaVector<size_t> runBands(numRuns + 1, bands.size());
+        {
+            size_t total = 0;
+            for (auto& band: bands)
+                total += band.size();
+            size_t sum = 0;
+            size_t run = 1;
+            runBands[0] = 0;
+            for (size_t b = 0; b < bands.size(); ++b) {
+                sum += bands[b].size();
+                while (run < numRuns && sum * numRuns >= total * run)
+                    runBands[run++] = b + 1;
+            }
+        }
+        ArenaVector<ArenaVector<ScanlineBasePoint>> runHotPixels(numRuns);
+        ArenaVector<ArenaVector<Split>> runSplits(numRuns);
+
+        ArenaVector<ScanlineBasePoint> hotPixels;
+        ArenaVector<Split> splits;
+        hotPixels.reserve(size * 2);
+        splits.reserve(size * 2);
+        for (auto& box: boxes) {
+            hotPixels.push_back(box.low);
+            hotPixels.push_back(box.high);
+        }
+
+        auto gather = [&]() {
+            for (size_t run = 1; run < numRuns; ++run) {
+                hotPixels.insert(hotPixels.end(), runHotPixels[run].begin(), runHotPixels[run].end());
+                splits.insert(splits.end(), runSplits[run].begin(), runSplits[run].end());
+                runHotPixels[run] = {};
+                runSplits[run] = {};
+            }
+        };
+
+        // Intersections. A crossing pair meets within a band where the x ranges of both parts
+        // overlap; the pair is tested in each run of such bands, in the first band of the run.
+        // Repeats find the same point and drop out when the points are sorted.
+        parallelFor(policy, numRuns, [&](size_t run) {
+            typename ScanlineBase::compute_intersection_pack pack;
+            auto& runPixels = run ? runHotPixels[run] : hotPixels;
+            auto& found = run ? runSplits[run] : splits;
+            for (size_t b = runBands[run]; b < runBands[run + 1]; ++b) {
+                auto& band = bands[b];
+                for (size_t i = 0; i < band.size(); ++i) {
+                    for (size_t j = i + 1; j < band.size() && band[j].lowX <= band[i].highX; ++j) {
+                        auto& e1 = boxes[std::min(band[i].box, band[j].box)];
+                        auto& e2 = boxes[std::max(band[i].box, band[j].box)];
+                        if (x(e2.low) >= x(e1.high))
+                            continue;
+                        if (e2.minY > e1.maxY || e1.minY > e2.maxY)
+                            continue;
+                        if (e1.low == e2.low || e1.high == e2.high)
+                            continue;
+                        if (b > bandOf(std::max(e1.minY, e2.minY))) {
+                            Unit low1, high1, low2, high2;
+                            clip(e1, b - 1, low1, high1);
+                            clip(e2, b - 1, low2, high2);
+                            if (low1 <= high2 && low2 <= high1)
+                                continue;
+                        }
+                        ScanlineBasePoint intersection;
+                        if (pack.compute_intersection(intersection, HalfEdge{e1.low, e1.high}, HalfEdge{e2.low, e2.high})) {
+                            runPixels.push_back(intersection);
+                            found.push_back({e1.index, intersection});
+                            found.push_back({e2.index, intersection});
+                        }
+                    }
+                }
+            }
+        });
+        gather();
+
+        std::sort(hotPixels.begin(), hotPixels.end(), [](const ScanlineBasePoint& a, const ScanlineBasePoint& b) {
+            return x(a) < x(b) || x(a) == x(b) && y(a) < y(b);
+        });
+        hotPixels.erase(std::unique(hotPixels.begin(), hotPixels.end()), hotPixels.end());
+
+        // Hot pixels each edge passes through. An edge passes through a hot pixel within its part
+        // in the pixel's band, so each pixel is tested against the parts in its own band only.
+        ArenaVector<size_t> bandPixelsBegin(bands.size() + 1);
+        for (auto& p: hotPixels)
+            ++bandPixelsBegin[bandOf(y(p)) + 1];
+        std::partial_sum(bandPixelsBegin.begin(), bandPixelsBegin.end(), bandPixelsBegin.begin());
+        ArenaVector<ScanlineBasePoint> bandPixels(hotPixels.size());
+        {
+            auto pos = bandPixelsBegin;
+            for (auto& p: hotPixels)
+                bandPixels[pos[bandOf(y(p))]++] = p;
+        }
+        parallelFor(policy, numRuns, [&](size_t run) {
+            auto& found = run ? runSplits[run] : splits;
+            for (size_t b = runBands[run]; b < runBands[run + 1]; ++b) {
+                auto pixelsBegin = bandPixels.begin() + bandPixelsBegin[b];
+                auto pixelsEnd = bandPixels.begin() + bandPixelsBegin[b + 1];
+                for (auto& part: bands[b]) {
+                    auto& box = boxes[part.box];
+                    while (pixelsBegin != pixelsEnd && x(*pixelsBegin) < part.lowX)
+                        ++pixelsBegin;
+                    HalfEdge halfEdge{box.low, box.high};
+                    double dx = (double)x(box.high) - x(box.low);
+                    double dy = (double)y(box.high) - y(box.low);
+                    double limit = 2 * (dx * dx + dy * dy) * (1 + 1e-4); // margin covers rounding in cross
+                    for (auto it = pixelsBegin; it != pixelsEnd && x(*it) <= part.highX; ++it) {
+                        if (y(*it) < box.minY || y(*it) > box.maxY)
+                            continue;
+
+                        // Skip pixels whose center is further than sqrt(2)/2 from the line; cheaper than intersects_grid
+                        double cross = dx * (2.0 * ((double)y(*it) - y(box.low)) + 1) - dy * (2.0 * ((double)x(*it) - x(box.low)) + 1);
+                        if (cross * cross > limit)
+                            continue;
+                        if (ScanlineBase::intersects_grid(*it, halfEdge))
+                            found.push_back({box.index, *it});
+                    }
+                }
+            }
+        });
+        gather();
+
+        // Bucket points by edge, then order each edge's points along it. validate_scan orders
+        // downward edges' points by descending y.
+        ArenaVector<size_t> pointsBegin(size + 1);
+        for (auto& split: splits)
+            ++pointsBegin[split.index + 1];
+        std::partial_sum(pointsBegin.begin(), pointsBegin.end(), pointsBegin.begin());
+        ArenaVector<ScanlineBasePoint> points(splits.size());
+        {
+            auto pos = pointsBegin;
+            for (auto& split: splits)
+                points[pos[split.index]++] = split.point;
+        }
+        ArenaVector<size_t> pointsEnd(size);
+        parallelFor(policy, numRuns, [&](size_t run) {
+            for (size_t i = size * run / numRuns; i < size * (run + 1) / numRuns; ++i) {
+                auto first = points.begin() + pointsBegin[i];
+                auto last = points.begin() + pointsBegin[i + 1];
+                auto p1 = toScanlineBasePoint(begin[i].point1);
+                auto p2 = toScanlineBasePoint(begin[i].point2);
+                bool downward = x(p1) != x(p2) && ScanlineBase::less_slope(x(p1), y(p1), p2, ScanlineBasePoint{x(p1) + 1, y(p1)});
+                std::sort(first, last, [downward](const ScanlineBasePoint& a, const ScanlineBasePoint& b) {
+                    if (x(a) != x(b))
+                        return x(a) < x(b);
+                    return downward ? y(a) > y(b) : y(a) < y(b);
+                });
+                pointsEnd[i] = std::unique(first, last) - points.begin();
+            }
+        });
+        size_t numPoints = 0;
+        for (size_t i = 0; i < size; ++i) {
+            auto first = points.begin() + pointsBegin[i];
+            pointsBegin[i] = numPoints;
+            numPoints = std::move(first, points.begin() + pointsEnd[i], points.begin() + numPoints) - points.begin();
+        }
+        pointsBegin[size] = numPoints;
+        auto numPieces = [&pointsBegin](size_t i) { return std::max(pointsBegin[i + 1] - pointsBegin[i], size_t(1)) - 1; };
+
+        size_t numEdges = 0;
+        bool dropped = false;
+        for (size_t i = 0; i < size; ++i) {
+            numEdges += numPieces(i);
+            dropped = dropped || !numPieces(i);
+        }
+
+        // In place: grow dest, then fill from the back so that every write lands on an edge which
+        // has already been split. That only holds if every edge produces at least one piece.
+        if (!dropped && dest.size() == size && &dest[0] == &*begin) {
+            dest.resize(numEdges);
+            size_t pos = numEdges;
+            for (size_t i = size; i-- > 0;) {
+                Edge edge = dest[i];
+                pos -= numPieces(i);
+                splitEdge(edge, &points[pointsBegin[i]], pointsBegin[i + 1] - pointsBegin[i], dest.begin() + pos);
+            }
+        }
+        else {
+            Container result;
+            result.reserve(numEdges);
+            for (size_t i = 0; i < size; ++i)
+                splitEdge(begin[i], &points[pointsBegin[i]], pointsBegin[i + 1] - pointsBegin[i], std::back_inserter(result));
+            dest = move(result);
+        }
+
+        CAM_PROFILE_COUNT("intersectEdges.edgesIn", size);
+        CAM_PROFILE_COUNT("intersectEdges.edgesOut", numEdges);
+        CAM_PROFILE_COUNT("intersectEdges.bytes",
+            boxes.capacity() * sizeof(boxes[0]) + hotPixels.capacity() * sizeof(hotPixels[0]) * 2 +
+            splits.capacity() * sizeof(splits[0]) + points.capacity() * sizeof(points[0]));
+    }
+
+    // Split edges at intersections using boost's validate_scan. Produces the same edges as
+    // intersectEdges; kept as a reference for the benchmark.
+    template<typename Container, typename It>
+    static void intersectEdgesBoost(Container& dest, It begin, It end) {
+        CAM_PROFILE_ZONE("intersectEdgesBoost");
+
+        // validate_scan dereferences begin even when the range is empty
+        if (begin == end) {
+            dest.clear();
+            return;
+        }
+
         // boost.polygon's authors should be banned from using pair for life.
         //                   <         <      p1,                 p2        >,     <property, deltaWindingNumber> >    I'm using property to hold index.
         std::vector<std::pair<std::pair<ScanlineBasePoint, ScanlineBasePoint>, std::pair<int, int>>> segments;
@@ -279,23 +632,57 @@ struct Scan {
             result.push_back(edge);
         }
 
+        CAM_PROFILE_COUNT("intersectEdgesBoost.edgesIn", size);
+        CAM_PROFILE_COUNT("intersectEdgesBoost.edgesOut", result.size());
+        CAM_PROFILE_COUNT("intersectEdgesBoost.bytes",
+            segments.capacity() * sizeof(segments[0]) + intersected.capacity() * sizeof(intersected[0]) + result.capacity() * sizeof(result[0]));
         dest = move(result);
     }
 
     template<typename EdgeIt>
     static void sortEdges(EdgeIt begin, EdgeIt end) {
+        CAM_PROFILE_ZONE("sortEdges");
         std::sort(begin, end, lessEdge);
     }
 
+    // Coincident edges are ordered by address (lessEdge order) so callbacks see them in a
+    // stable order
     static bool lessScanlineEdge(const ScanlineEdge& e1, const ScanlineEdge& e2)
     {
         return combineLess(
             e1, e2,
             [](const ScanlineEdge& e1, const ScanlineEdge& e2){return e1.yIntercept < e2.yIntercept; },
             [](const ScanlineEdge& e1, const ScanlineEdge& e2){return e1.atEndpoint < e2.atEndpoint; },
-            LessSlope{});
+            LessSlope{},
+            [](const ScanlineEdge& e1, const ScanlineEdge& e2){return e1.edge < e2.edge; });
     }
 
+    // y and atEndpoint of an edge at scanX, computed without touching the cached fields
+    static HighPrecision getYInterceptAt(Unit scanX, const ScanlineEdge& e, bool& atEndpoint)
+    {
+        auto& edge = *e.edge;
+        atEndpoint = true;
+        if (scanX == x(edge.point1))
+            return y(edge.point1);
+        if (scanX == x(edge.point2))
+            return y(edge.point2);
+        atEndpoint = false;
+        return getYIntercept(scanX, edge);
+    }
+
+    // Same order as lessScanlineEdge, evaluated at scanX
+    struct LessScanlineEdgeAt {
+        Unit scanX;
+
+        bool operator()(const ScanlineEdge& e1, const ScanlineEdge& e2) const
+        {
+            bool atEndpoint1, atEndpoint2;
+            HighPrecision y1 = getYInterceptAt(scanX, e1, atEndpoint1);
+            HighPrecision y2 = getYInterceptAt(scanX, e2, atEndpoint2);
+            return y1 < y2 || !(y2 < y1) && (atEndpoint1 < atEndpoint2 || atEndpoint1 == atEndpoint2 && (LessSlope{}(e1, e2) || !LessSlope{}(e2, e1) && e1.edge < e2.edge));
+        }
+    };
+
     template<typename It, typename Callback0, typename... Callback>
     static void callCallback(Unit scanX, HighPrecision scanY, It begin, It end, const Callback0& callback0, const Callback&... callback)
     {
@@ -311,6 +698,18 @@ struct Scan {
     }
 
     // Scan edges. Edges must not have any intersections and must already be sorted using lessEdge.
+    //
+    // The scanline stays sorted between stops: edges which don't intersect can't change
+    // order, so only edges meeting at a shared endpoint need re-sorting. New edges are
+    // merged in by binary search and a heap of point2 x values supplies the next stop. Edges
+    // which end at a stop are dropped from the first of them on; stops where none end don't
+    // move the scanline at all.
+    //
+    // Callbacks still see every scanline edge at every stop, so a stop costs O(scanline
+    // edges) in the callbacks whatever the scan does. yIntercept is only kept for edges at
+    // an endpoint (atEndpoint): for an edge passing through scanX it holds the y of an
+    // earlier stop, and so does scanY for a group which isn't at an endpoint. Callbacks must
+    // not read either there; use getYIntercept(scanX, *e.edge) if the y is needed.
     template<typename EdgeIt, typename... Callback>
     static void scan(
         EdgeIt edgeBegin,
@@ -321,13 +720,25 @@ struct Scan {
         if (edgeBegin == edgeEnd)
             return;
 
+        CAM_PROFILE_ZONE("scan");
+        CAM_PROFILE_COUNT("scan.edges", edgeEnd - edgeBegin);
         Unit scanX = x(edgeBegin->point1);
-        std::vector<ScanlineEdge> scanlineEdges;
+        ArenaVector<ScanlineEdge> scanlineEdges;
+        ArenaVector<ScanlineEdge> newEdges;
+        ArenaVector<ScanlineEdge> merged;
+        std::priority_queue<Unit, ArenaVector<Unit>, std::greater<Unit>> point2X;
+        size_t numStops = 0;
         while (edgeBegin != edgeEnd || !scanlineEdges.empty()) {
+            ++numStops;
+            newEdges.clear();
             while (edgeBegin != edgeEnd && x(edgeBegin->point1) == scanX) {
                 ScanlineEdge sledge{&*edgeBegin};
                 sledge.atPoint1 = true;
-                scanlineEdges.push_back(sledge);
+                sledge.atEndpoint = true;
+                sledge.yIntercept = y(edgeBegin->point1);
+                newEdges.push_back(sledge);
+                if (x(edgeBegin->point1) != x(edgeBegin->point2))
+                    point2X.push(x(edgeBegin->point2));
                 if (debug) {
                     printf("add: (%d, %d), (%d, %d) %s\n",
                         x(edgeBegin->point1), y(edgeBegin->point1), x(edgeBegin->point2), y(edgeBegin->point2),
@@ -336,13 +747,44 @@ struct Scan {
                 ++edgeBegin;
             }
 
+            // Merge new edges into the scanline
+            if (!newEdges.empty()) {
+                std::sort(newEdges.begin(), newEdges.end(), lessScanlineEdge);
+                if (scanlineEdges.empty())
+                    std::swap(scanlineEdges, newEdges);
+                else {
+                    merged.clear();
+                    merged.reserve(scanlineEdges.size() + newEdges.size());
+                    auto pos = scanlineEdges.begin();
+                    for (auto& newEdge: newEdges) {
+                        auto next = std::upper_bound(pos, scanlineEdges.end(), newEdge, LessScanlineEdgeAt{scanX});
+                        merged.insert(merged.end(), pos, next);
+                        merged.push_back(newEdge);
+                        pos = next;
+                    }
+                    merged.insert(merged.end(), pos, scanlineEdges.end());
+                    std::swap(scanlineEdges, merged);
+                }
+            }
+
+            // Refresh endpoint state. Edges which end at scanX keep their order from the last
+            // stop, so sort each run meeting at a common point.
             for (auto& scanlineEdge: scanlineEdges) {
                 auto& edge = *scanlineEdge.edge;
-                scanlineEdge.yIntercept = getYIntercept(scanX, edge);
                 scanlineEdge.atEndpoint = scanX == x(edge.point1) || scanX == x(edge.point2);
+                if (scanlineEdge.atEndpoint)
+                    scanlineEdge.yIntercept = scanX == x(edge.point1) ? y(edge.point1) : y(edge.point2);
+            }
+            for (auto it = scanlineEdges.begin(); it != scanlineEdges.end();) {
+                auto e = it + 1;
+                if (it->atEndpoint) {
+                    while (e != scanlineEdges.end() && e->atEndpoint && e->yIntercept == it->yIntercept)
+                        ++e;
+                    if (e - it > 1)
+                        std::sort(it, e, lessScanlineEdge);
+                }
+                it = e;
             }
-
-            sort(begin(scanlineEdges), end(scanlineEdges), lessScanlineEdge);
 
             if (debug) {
                 printf("\nscan line:\n");
@@ -353,11 +795,14 @@ struct Scan {
                         x(e.edge->point1) == x(e.edge->point2) ? "vertical" : "");
                 }
                 for (size_t i = 0; i < scanlineEdges.size()-1; ++i) {
-                    printf("\n%d < %d?  %d\n", i, i+1, LessSlope{}(scanlineEdges[i], scanlineEdges[i+1]));
-                    printf("%d < %d?  %d\n", i+1, i, LessSlope{}(scanlineEdges[i+1], scanlineEdges[i]));
+                    printf("\n%zu < %zu?  %d\n", i, i+1, LessSlope{}(scanlineEdges[i], scanlineEdges[i+1]));
+                    printf("%zu < %zu?  %d\n", i+1, i, LessSlope{}(scanlineEdges[i+1], scanlineEdges[i]));
                 }
             }
 
+            // Index of the first edge which ends at this stop; nothing before it moves when
+            // the ended edges are dropped.
+            size_t firstEnded = scanlineEdges.size();
             auto scanlineEdgeIt = begin(scanlineEdges);
             while (scanlineEdgeIt != end(scanlineEdges)) {
                 auto e = scanlineEdgeIt + 1;
@@ -370,6 +815,8 @@ struct Scan {
                         it->atPoint1 = scanX == x(edge.point1);
                         it->atPoint2 = scanX == x(edge.point2);
                     }
+                    if (scanX == x(edge.point2))
+                        firstEnded = std::min(firstEnded, size_t(it - begin(scanlineEdges)));
                     //printf("atEndpoint: %d, atPoint1: %d, atPoint2: %d, yIntercept: %d, (%d, %d), (%d, %d) %s\n",
                     //    it->atEndpoint, it->atPoint1, it->atPoint2, int(it->yIntercept),
                     //    x(edge.point1), y(edge.point1), x(edge.point2), y(edge.point2),
@@ -397,16 +844,23 @@ struct Scan {
                 }
             }
 
-            scanlineEdges.erase(
-                std::remove_if(scanlineEdges.begin(), scanlineEdges.end(), [](const ScanlineEdge& e){return e.atPoint2; }),
-                scanlineEdges.end());
+            if (firstEnded < scanlineEdges.size()) {
+                scanlineEdges.erase(
+                    std::remove_if(
+                        scanlineEdges.begin() + firstEnded, scanlineEdges.end(),
+                        [](const ScanlineEdge& e){return e.atPoint2; }),
+                    scanlineEdges.end());
+            }
 
+            while (!point2X.empty() && point2X.top() <= scanX)
+                point2X.pop();
             scanX = std::numeric_limits<Unit>::max();
-            for (auto& e: scanlineEdges)
-                scanX = std::min(scanX, x(e.edge->point2));
+            if (!point2X.empty())
+                scanX = point2X.top();
             if (edgeBegin != edgeEnd)
                 scanX = std::min(scanX, x(edgeBegin->point1));
         }
+        CAM_PROFILE_COUNT("scan.stops", numStops);
     }
 }; // Scan
 
@@ -472,7 +926,7 @@ struct AccumulateWindingNumber {
         const bool debug = false;
 
         if (debug)
-            printf("AccumulateWindingNumber %d\n", end-begin);
+            printf("AccumulateWindingNumber %td\n", end-begin);
         while (begin != end) {
             // non-vertical
             while (begin != end && x(begin->edge->point1) != x(begin->edge->point2)) {
@@ -497,6 +951,8 @@ struct AccumulateWindingNumber {
                 }
                 ++begin;
             }
+            if (begin == end)
+                break;
 
             // vertical
             bool atPoint1 = begin->atPoint1;
@@ -601,7 +1057,7 @@ public:
     CombinePairs& operator=(CombinePairs&&) = default;
 
 private:
-    mutable std::vector<ScanlineEdge*> candidates;
+    mutable ArenaVector<ScanlineEdge*> candidates;
 
     // negative: polygon travels from edge to scan point
     // positive: polygon travels from scan point to edge
@@ -618,8 +1074,6 @@ public:
     template<typename Unit, typename HighPrecision, typename It>
     void operator()(Unit scanX, HighPrecision scanY, It begin, It end) const
     {
-        using Scan = Scan<ScanlineEdge>;
-
         //printf("CombinePairs %d\n", end-begin);
         candidates.clear();
         candidates.reserve(end-begin);
@@ -691,17 +1145,20 @@ void fillPolygonSetFromEdges(PolygonSet& ps, It begin, It end) {
     }
 }
 
+// Edges cleanPolygonSet works on
+template<typename Point>
+using CleanEdge_t = Edge<Point, EdgeNext>;
+
+// cleanPolygonSet for edges which are already inserted (Scan::insertPolygons). Works in
+// edges: intersectEdges splits them and the scan links them. Clear it to reuse the buffer.
 template<typename PolygonSet, typename Winding>
-PolygonSet cleanPolygonSet(const PolygonSet& ps, Winding winding) {
-    using Point = PointFromPolygonSet_t<PolygonSet>;
-    using Edge = Edge<Point, EdgeNext>;
+PolygonSet cleanEdgesInPlace(ArenaVector<CleanEdge_t<PointFromPolygonSet_t<PolygonSet>>>& edges, Winding winding, const ExecutionPolicy& policy = defaultExecutionPolicy()) {
+    using Edge = CleanEdge_t<PointFromPolygonSet_t<PolygonSet>>;
     using ScanlineEdge = ScanlineEdge<Edge, ScanlineEdgeExclude, ScanlineEdgeWindingNumber>;
     using Scan = Scan<ScanlineEdge>;
 
-    std::vector<Edge> edges;
-    Scan::insertPolygons(edges, ps.begin(), ps.end());
-
-    Scan::intersectEdges(edges, edges.begin(), edges.end());
+    CAM_PROFILE_ZONE("cleanPolygonSet");
+    Scan::intersectEdges(edges, edges.begin(), edges.end(), policy);
     Scan::sortEdges(edges.begin(), edges.end());
     Scan::scan(
         edges.begin(), edges.end(),
@@ -714,6 +1171,22 @@ PolygonSet cleanPolygonSet(const PolygonSet& ps, Winding winding) {
     return result;
 }
 
+// cleanEdgesInPlace, taking ownership of edges
+template<typename PolygonSet, typename Winding>
+PolygonSet cleanEdges(ArenaVector<CleanEdge_t<PointFromPolygonSet_t<PolygonSet>>> edges, Winding winding, const ExecutionPolicy& policy = defaultExecutionPolicy()) {
+    return cleanEdgesInPlace<PolygonSet>(edges, winding, policy);
+}
+
+template<typename PolygonSet, typename Winding>
+PolygonSet cleanPolygonSet(const PolygonSet& ps, Winding winding, const ExecutionPolicy& policy = defaultExecutionPolicy()) {
+    using Edge = CleanEdge_t<PointFromPolygonSet_t<PolygonSet>>;
+    using Scan = Scan<ScanlineEdge<Edge>>;
+
+    ArenaVector<Edge> edges;
+    Scan::insertPolygons(edges, ps.begin(), ps.end());
+    return cleanEdges<PolygonSet>(move(edges), winding, policy);
+}
+
 template<typename CompareWinding>
 struct CombinePolygonSetCondition {
     CompareWinding compareWinding;
@@ -735,20 +1208,21 @@ CombinePolygonSetCondition<CompareWinding> makeCombinePolygonSetCondition(Compar
 }
 
 template<typename PolygonSet, typename Condition>
-PolygonSet combinePolygonSet(const PolygonSet& ps1, const PolygonSet& ps2, Condition condition) {
+PolygonSet combinePolygonSet(const PolygonSet& ps1, const PolygonSet& ps2, Condition condition, const ExecutionPolicy& policy = defaultExecutionPolicy()) {
     using Point = PointFromPolygonSet_t<PolygonSet>;
     using Edge = Edge<Point, EdgeId, EdgeNext>;
     using ScanlineEdge = ScanlineEdge<Edge, ScanlineEdgeWindingNumber, ScanlineEdgeWindingNumber2>;
     using Scan = Scan<ScanlineEdge>;
 
-    std::vector<Edge> edges;
+    CAM_PROFILE_ZONE("combinePolygonSet");
+    ArenaVector<Edge> edges;
     Scan::insertPolygons(edges, ps1.begin(), ps1.end());
     size_t edges1Size = edges.size();
     Scan::insertPolygons(edges, ps2.begin(), ps2.end());
     for (size_t i = edges1Size; i < edges.size(); ++i)
         edges[i].id = 1;
 
-    Scan::intersectEdges(edges, edges.begin(), edges.end());
+    Scan::intersectEdges(edges, edges.begin(), edges.end(), policy);
     Scan::sortEdges(edges.begin(), edges.end());
     Scan::scan(
         edges.begin(), edges.end(),
@@ -762,4 +1236,469 @@ PolygonSet combinePolygonSet(const PolygonSet& ps1, const PolygonSet& ps2, Condi
     return result;
 }
 
+// Bounding volume hierarchy over polygon edges, for queries which only need the edges
+// near a point or segment: segment intersection, nearest edge and point in polygon.
+// Build it once per geometry and reuse it across operations.
+//
+// Edges and nodes are stored as one array per field. Nodes are in depth-first order and
+// each holds the index of the node after its subtree (skip), so queries walk forward
+// through the arrays without a stack, jumping over subtrees whose boxes miss.
+template<typename Point>
+class EdgeBvh {
+public:
+    using Unit = UnitFromPoint_t<Point>;
+    using Area = ManhattanAreaFromUnit_t<Unit>;
+
+    static const size_t leafSize = 4;
+
+    EdgeBvh() = default;
+
+    // Edges of ps; polygons are closed unless closed is false
+    template<typename PolygonSet>
+    explicit EdgeBvh(const PolygonSet& ps, bool closed = true)
+    {
+        CAM_PROFILE_ZONE("EdgeBvh");
+        std::vector<Point> p1, p2;
+        std::vector<int> polygon;
+        int polygonIndex = 0;
+        for (auto& poly: ps) {
+            size_t size = poly.end() - poly.begin();
+            for (size_t i = 0; i < size; ++i) {
+                if (i + 1 == size && !closed)
+                    break;
+                auto& a = poly.begin()[i];
+                auto& b = poly.begin()[i + 1 < size ? i + 1 : 0];
+                if (x(a) == x(b) && y(a) == y(b))
+                    continue;
+                p1.emplace_back(x(a), y(a));
+                p2.emplace_back(x(b), y(b));
+                polygon.push_back(polygonIndex);
+            }
+            ++polygonIndex;
+        }
+
+        std::vector<size_t> order(p1.size());
+        std::iota(order.begin(), order.end(), 0);
+        if (!order.empty())
+            build(p1, p2, order, 0, order.size());
+
+        for (auto i: order) {
+            x1.push_back(x(p1[i]));
+            y1.push_back(y(p1[i]));
+            x2.push_back(x(p2[i]));
+            y2.push_back(y(p2[i]));
+            polygons.push_back(polygon[i]);
+        }
+        CAM_PROFILE_COUNT("EdgeBvh.edges", x1.size());
+    }
+
+    size_t size() const { return x1.size(); }
+    bool empty() const { return x1.empty(); }
+
+    // Edge i runs from point1(i) to point2(i), in its polygon's direction
+    Point point1(size_t i) const { return Point(x1[i], y1[i]); }
+    Point point2(size_t i) const { return Point(x2[i], y2[i]); }
+
+    // Index in ps of the polygon holding edge i
+    int polygon(size_t i) const { return polygons[i]; }
+
+    // Call f(edge) for each edge whose bounding box overlaps [low, high]. Stops and
+    // returns true once f returns true.
+    template<typename F>
+    bool forEachInBox(Point low, Point high, F f) const
+    {
+        return walk(
+            [&](size_t n) {
+                return minX[n] <= x(high) && maxX[n] >= x(low) && minY[n] <= y(high) && maxY[n] >= y(low);
+            },
+            [&](size_t e) {
+                return std::min(x1[e], x2[e]) <= x(high) && std::max(x1[e], x2[e]) >= x(low) &&
+                    std::min(y1[e], y2[e]) <= y(high) && std::max(y1[e], y2[e]) >= y(low) && f(e);
+            });
+    }
+
+    // Call f(edge) for each edge which segment ab touches or crosses. Stops and returns
+    // true once f returns true.
+    template<typename F>
+    bool forEachIntersecting(Point a, Point b, F f) const
+    {
+        Point low(std::min(x(a), x(b)), std::min(y(a), y(b)));
+        Point high(std::max(x(a), x(b)), std::max(y(a), y(b)));
+        return forEachInBox(low, high, [&](size_t e) {
+            return segmentsIntersect(a, b, point1(e), point2(e)) && f(e);
+        });
+    }
+
+    // Does segment ab touch or cross an edge?
+    bool intersects(Point a, Point b) const
+    {
+        return forEachIntersecting(a, b, [](size_t) { return true; });
+    }
+
+    // Edge nearest p, or size() if there are none. Sets dist2 to its squared distance.
+    size_t nearest(Point p, double& dist2) const
+    {
+        size_t best = size();
+        dist2 = std::numeric_limits<double>::max();
+        walk(
+            [&](size_t n) {
+                double dx = std::max({(double)minX[n] - x(p), 0.0, (double)x(p) - maxX[n]});
+                double dy = std::max({(double)minY[n] - y(p), 0.0, (double)y(p) - maxY[n]});
+                return dx * dx + dy * dy < dist2;
+            },
+            [&](size_t e) {
+                double d = squaredDistToEdge(p, e);
+                if (d < dist2) {
+                    dist2 = d;
+                    best = e;
+                }
+                return false;
+            });
+        return best;
+    }
+
+    // Winding number of p: edges crossing the ray from p in +x, counted +1 going up and
+    // -1 going down. Meaningful for closed polygons; points on an edge may go either way.
+    int windingNumber(Point p) const
+    {
+        int winding = 0;
+        walk(
+            [&](size_t n) {
+                return minY[n] <= y(p) && maxY[n] >= y(p) && maxX[n] >= x(p);
+            },
+            [&](size_t e) {
+                if (y1[e] <= y(p) && y2[e] > y(p) && cross(point1(e), point2(e), p) > 0)
+                    ++winding;
+                else if (y2[e] <= y(p) && y1[e] > y(p) && cross(point1(e), point2(e), p) < 0)
+                    --winding;
+                return false;
+            });
+        return winding;
+    }
+
+    // Is p inside (nonzero winding)?
+    bool contains(Point p) const
+    {
+        return windingNumber(p) != 0;
+    }
+
+    // Does segment ab stay inside (nonzero winding)? Stretches along an edge count as
+    // inside.
+    bool containsSegment(Point a, Point b) const
+    {
+        // Crossing an edge leaves. Edges which only touch ab split it into pieces, each
+        // all inside or all outside, so one point in each decides.
+        std::vector<double> ts{0, 1};
+        double len2 = lenSquared(a, b);
+        bool crosses = forEachIntersecting(a, b, [&](size_t e) {
+            Point c = point1(e), d = point2(e);
+            Area d1 = cross(c, d, a), d2 = cross(c, d, b);
+            Area d3 = cross(a, b, c), d4 = cross(a, b, d);
+            if ((d1 > 0 && d2 < 0 || d1 < 0 && d2 > 0) && (d3 > 0 && d4 < 0 || d3 < 0 && d4 > 0))
+                return true;
+            if (len2 > 0) {
+                if (d3 == 0 && inBox(a, b, c))
+                    ts.push_back(dot(a, b, c) / len2);
+                if (d4 == 0 && inBox(a, b, d))
+                    ts.push_back(dot(a, b, d) / len2);
+            }
+            return false;
+        });
+        if (crosses)
+            return false;
+
+        std::sort(ts.begin(), ts.end());
+        for (size_t i = 0; i + 1 < ts.size(); ++i) {
+            if (ts[i] == ts[i + 1])
+                continue;
+            double t = (ts[i] + ts[i + 1]) / 2;
+            Point p(
+                Unit(std::lround(x(a) + t * ((double)x(b) - x(a)))),
+                Unit(std::lround(y(a) + t * ((double)y(b) - y(a)))));
+            double dist2;
+            nearest(p, dist2);
+            if (dist2 >= 1 && !contains(p))
+                return false;
+        }
+        return true;
+    }
+
+private:
+    // Edges, in leaf order
+    std::vector<Unit> x1, y1, x2, y2;
+    std::vector<int> polygons;
+
+    // Nodes. A node with count > 0 is a leaf holding edges [first, first + count); an
+    // inner node's children are the next node and the one after its subtree.
+    std::vector<Unit> minX, minY, maxX, maxY;
+    std::vector<size_t> skip;
+    std::vector<size_t> first;
+    std::vector<size_t> count;
+
+    // Node for order[begin, end), then its subtree. Splits at the median edge center along
+    // the longer axis.
+    void build(const std::vector<Point>& p1, const std::vector<Point>& p2, std::vector<size_t>& order, size_t begin, size_t end)
+    {
+        size_t node = skip.size();
+        Unit lx = std::numeric_limits<Unit>::max(), ly = lx;
+        Unit hx = std::numeric_limits<Unit>::min(), hy = hx;
+        for (size_t i = begin; i < end; ++i) {
+            for (auto& p: {p1[order[i]], p2[order[i]]}) {
+                lx = std::min(lx, x(p));
+                ly = std::min(ly, y(p));
+                hx = std::max(hx, x(p));
+                hy = std::max(hy, y(p));
+            }
+        }
+        minX.push_back(lx);
+        minY.push_back(ly);
+        maxX.push_back(hx);
+        maxY.push_back(hy);
+        skip.push_back(0);
+        first.push_back(begin);
+        count.push_back(0);
+
+        if (end - begin <= leafSize)
+            count[node] = end - begin;
+        else {
+            bool splitX = (double)hx - lx >= (double)hy - ly;
+            auto center = [&](size_t i) {
+                return splitX ? (double)x(p1[i]) + x(p2[i]) : (double)y(p1[i]) + y(p2[i]);
+            };
+            size_t mid = begin + (end - begin) / 2;
+            std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+                [&](size_t a, size_t b) { return center(a) < center(b); });
+            build(p1, p2, order, begin, mid);
+            build(p1, p2, order, mid, end);
+        }
+        skip[node] = skip.size();
+    }
+
+    // Visit nodes whose boxes pass nodeTest and the edges of those which are leaves.
+    // Stops and returns true once visitEdge returns true.
+    template<typename NodeTest, typename VisitEdge>
+    bool walk(NodeTest nodeTest, VisitEdge visitEdge) const
+    {
+        size_t n = 0;
+        while (n < skip.size()) {
+            if (!nodeTest(n))
+                n = skip[n];
+            else if (count[n]) {
+                for (size_t e = first[n]; e < first[n] + count[n]; ++e)
+                    if (visitEdge(e))
+                        return true;
+                n = skip[n];
+            }
+            else
+                ++n;
+        }
+        return false;
+    }
+
+    static Area cross(Point o, Point a, Point b)
+    {
+        return (Area(x(a)) - x(o)) * (Area(y(b)) - y(o)) - (Area(y(a)) - y(o)) * (Area(x(b)) - x(o));
+    }
+
+    static double lenSquared(Point a, Point b)
+    {
+        double dx = (double)x(b) - x(a), dy = (double)y(b) - y(a);
+        return dx * dx + dy * dy;
+    }
+
+    // (b - a) . (p - a)
+    static double dot(Point a, Point b, Point p)
+    {
+        return ((double)x(b) - x(a)) * ((double)x(p) - x(a)) + ((double)y(b) - y(a)) * ((double)y(p) - y(a));
+    }
+
+    static bool inBox(Point a, Point b, Point p)
+    {
+        return std::min(x(a), x(b)) <= x(p) && x(p) <= std::max(x(a), x(b)) &&
+            std::min(y(a), y(b)) <= y(p) && y(p) <= std::max(y(a), y(b));
+    }
+
+    static bool segmentsIntersect(Point a, Point b, Point c, Point d)
+    {
+        Area d1 = cross(c, d, a), d2 = cross(c, d, b);
+        Area d3 = cross(a, b, c), d4 = cross(a, b, d);
+        if ((d1 > 0 && d2 < 0 || d1 < 0 && d2 > 0) && (d3 > 0 && d4 < 0 || d3 < 0 && d4 > 0))
+            return true;
+        return d1 == 0 && inBox(c, d, a) || d2 == 0 && inBox(c, d, b) ||
+            d3 == 0 && inBox(a, b, c) || d4 == 0 && inBox(a, b, d);
+    }
+
+    double squaredDistToEdge(Point p, size_t e) const
+    {
+        double dx = (double)x2[e] - x1[e];
+        double dy = (double)y2[e] - y1[e];
+        double t = (((double)x(p) - x1[e]) * dx + ((double)y(p) - y1[e]) * dy) / (dx * dx + dy * dy);
+        t = std::max(0.0, std::min(1.0, t));
+        double ex = x1[e] + t * dx - x(p);
+        double ey = y1[e] + t * dy - y(p);
+        return ex * ex + ey * ey;
+    }
+}; // EdgeBvh
+
+// k-d tree over points, for repeated nearest-point queries while points are taken out:
+// ordering toolpaths by the shortest rapid to the next one. Removing a point is
+// O(log n) and queries skip subtrees with nothing left in them.
+//
+// Laid out like EdgeBvh: points and nodes are stored as one array per field, with nodes
+// in depth-first order. A node's children are the next node and its first child's skip.
+template<typename Point>
+class PointKdTree {
+public:
+    using Unit = UnitFromPoint_t<Point>;
+
+    static const size_t leafSize = 8;
+
+    PointKdTree() = default;
+
+    // Queries return indexes into [begin, end)
+    template<typename It>
+    PointKdTree(It begin, It end)
+    {
+        std::vector<Point> points;
+        for (; begin != end; ++begin)
+            points.emplace_back(x(*begin), y(*begin));
+
+        std::vector<size_t> order(points.size());
+        std::iota(order.begin(), order.end(), 0);
+        leafOf.resize(points.size());
+        if (!order.empty())
+            build(points, order, 0, order.size(), 0);
+
+        slotOf.resize(points.size());
+        for (size_t slot = 0; slot < order.size(); ++slot) {
+            xs.push_back(x(points[order[slot]]));
+            ys.push_back(y(points[order[slot]]));
+            ids.push_back(order[slot]);
+            slotOf[order[slot]] = slot;
+        }
+        alive.assign(points.size(), true);
+    }
+
+    size_t size() const { return xs.size(); }
+
+    // Number of points not removed
+    size_t numLeft() const { return live.empty() ? 0 : live[0]; }
+
+    bool removed(size_t i) const { return !alive[slotOf[i]]; }
+
+    void remove(size_t i)
+    {
+        size_t slot = slotOf[i];
+        if (!alive[slot])
+            return;
+        alive[slot] = false;
+        for (size_t n = leafOf[i];; n = parent[n]) {
+            --live[n];
+            if (n == 0)
+                break;
+        }
+    }
+
+    // Nearest point not removed, or size() if there are none. Sets dist2 to its squared
+    // distance.
+    size_t nearest(Point p, double& dist2) const
+    {
+        size_t best = size();
+        dist2 = std::numeric_limits<double>::max();
+        if (numLeft())
+            nearest(0, x(p), y(p), best, dist2);
+        return best;
+    }
+
+private:
+    // Points, in leaf order; ids[slot] is the point's index in the input
+    std::vector<Unit> xs, ys;
+    std::vector<size_t> ids;
+    std::vector<char> alive;
+
+    // Input index to slot, and to the leaf holding it
+    std::vector<size_t> slotOf;
+    std::vector<size_t> leafOf;
+
+    // Nodes. A node with count > 0 is a leaf holding slots [first, first + count). live is
+    // the number of points left in the subtree. The root is node 0.
+    std::vector<Unit> minX, minY, maxX, maxY;
+    std::vector<size_t> skip;
+    std::vector<size_t> first;
+    std::vector<size_t> count;
+    std::vector<size_t> live;
+    std::vector<size_t> parent;
+
+    // Node for order[begin, end), then its subtree. Splits at the median along the longer
+    // axis.
+    void build(const std::vector<Point>& points, std::vector<size_t>& order, size_t begin, size_t end, size_t parentNode)
+    {
+        size_t node = skip.size();
+        Unit lx = std::numeric_limits<Unit>::max(), ly = lx;
+        Unit hx = std::numeric_limits<Unit>::min(), hy = hx;
+        for (size_t i = begin; i < end; ++i) {
+            auto& p = points[order[i]];
+            lx = std::min(lx, x(p));
+            ly = std::min(ly, y(p));
+            hx = std::max(hx, x(p));
+            hy = std::max(hy, y(p));
+        }
+        minX.push_back(lx);
+        minY.push_back(ly);
+        maxX.push_back(hx);
+        maxY.push_back(hy);
+        skip.push_back(0);
+        first.push_back(begin);
+        count.push_back(0);
+        live.push_back(end - begin);
+        parent.push_back(parentNode);
+
+        if (end - begin <= leafSize) {
+            count[node] = end - begin;
+            for (size_t i = begin; i < end; ++i)
+                leafOf[order[i]] = node;
+        }
+        else {
+            bool splitX = (double)hx - lx >= (double)hy - ly;
+            size_t mid = begin + (end - begin) / 2;
+            std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+                [&](size_t a, size_t b) { return splitX ? x(points[a]) < x(points[b]) : y(points[a]) < y(points[b]); });
+            build(points, order, begin, mid, node);
+            build(points, order, mid, end, node);
+        }
+        skip[node] = skip.size();
+    }
+
+    double boxDist2(size_t n, Unit px, Unit py) const
+    {
+        double dx = std::max({(double)minX[n] - px, 0.0, (double)px - maxX[n]});
+        double dy = std::max({(double)minY[n] - py, 0.0, (double)py - maxY[n]});
+        return dx * dx + dy * dy;
+    }
+
+    // Search n's subtree, nearer child first
+    void nearest(size_t n, Unit px, Unit py, size_t& best, double& dist2) const
+    {
+        if (!live[n] || boxDist2(n, px, py) >= dist2)
+            return;
+        if (count[n]) {
+            for (size_t slot = first[n]; slot < first[n] + count[n]; ++slot) {
+                if (!alive[slot])
+                    continue;
+                double dx = (double)xs[slot] - px, dy = (double)ys[slot] - py;
+                if (dx * dx + dy * dy < dist2) {
+                    dist2 = dx * dx + dy * dy;
+                    best = ids[slot];
+                }
+            }
+            return;
+        }
+        size_t a = n + 1, b = skip[n + 1];
+        if (boxDist2(b, px, py) < boxDist2(a, px, py))
+            std::swap(a, b);
+        nearest(a, px, py, best, dist2);
+        nearest(b, px, py, best, dist2);
+    }
+}; // PointKdTree
+
 } // namespace FlexScan
@@ -0,0 +1,209 @@
+// Copyright 2014 Todd Fleming
+//
+// This file is part of jscut.
+//
+// jscut is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// jscut is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with jscut.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "profile.h"
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace FlexScan {
+
+// Memory for the temporary containers of one operation (hspocket, vPocket, ...).
+// Small blocks are rounded up to a power of two and carved from shared chunks;
+// freed blocks go on a free list for their size and are handed out again, so
+// each stage reuses what the previous stage freed. Chunks go back to the heap
+// when the arena is destroyed. Large blocks come straight from the heap and go
+// back as soon as they're freed; malloc already reuses those well, and keeping
+// them would hide their pages from everything else.
+//
+// allocate and deallocate are thread safe.
+class Arena {
+public:
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    ~Arena()
+    {
+        CAM_PROFILE_COUNT("arena.bytes", bytesFromHeap);
+        for (void* chunk: chunks)
+            std::free(chunk);
+    }
+
+    void* allocate(size_t bytes)
+    {
+        if (bytes > maxBlockSize)
+            return ::operator new(bytes);
+
+        size_t sizeClass = getSizeClass(bytes);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (FreeBlock* block = freeLists[sizeClass]) {
+            freeLists[sizeClass] = block->next;
+            return block;
+        }
+
+        size_t blockSize = size_t(1) << sizeClass;
+        if (blockSize > size_t(chunkEnd - chunkPos)) {
+            chunkPos = static_cast<char*>(allocateChunk(chunkSize));
+            chunkEnd = chunkPos + chunkSize;
+        }
+        void* result = chunkPos;
+        chunkPos += blockSize;
+        return result;
+    }
+
+    void deallocate(void* p, size_t bytes)
+    {
+        if (bytes > maxBlockSize) {
+            ::operator delete(p);
+            return;
+        }
+
+        size_t sizeClass = getSizeClass(bytes);
+        std::lock_guard<std::mutex> lock(mutex);
+        auto block = static_cast<FreeBlock*>(p);
+        block->next = freeLists[sizeClass];
+        freeLists[sizeClass] = block;
+    }
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    static const size_t minSizeClass = 6;
+    static const size_t maxSizeClass = 16;
+    static const size_t maxBlockSize = size_t(1) << maxSizeClass;
+    static const size_t chunkSize = size_t(1) << 20;
+
+    std::mutex mutex;
+    std::vector<void*> chunks;
+    FreeBlock* freeLists[maxSizeClass + 1] = {};
+    char* chunkPos = nullptr;
+    char* chunkEnd = nullptr;
+    long long bytesFromHeap = 0;
+
+    // log2 of the block size which holds bytes
+    static size_t getSizeClass(size_t bytes)
+    {
+        size_t sizeClass = minSizeClass;
+        while ((size_t(1) << sizeClass) < bytes)
+            ++sizeClass;
+        return sizeClass;
+    }
+
+    void* allocateChunk(size_t bytes)
+    {
+        chunks.reserve(chunks.size() + 1);
+        void* chunk = std::malloc(bytes);
+        if (!chunk)
+            throw std::bad_alloc();
+        chunks.push_back(chunk);
+        bytesFromHeap += bytes;
+        return chunk;
+    }
+};
+
+// The arena containers on this thread allocate from; nullptr for the heap
+inline Arena*& currentArena()
+{
+    static thread_local Arena* arena = nullptr;
+    return arena;
+}
+
+// Makes a new arena current on this thread for the scope's lifetime. Containers
+// which use it must not outlive the scope.
+class ArenaScope {
+public:
+    ArenaScope() :
+        previous(currentArena())
+    {
+        currentArena() = &arena;
+    }
+
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+
+    ~ArenaScope()
+    {
+        currentArena() = previous;
+    }
+
+private:
+    Arena arena;
+    Arena* previous;
+};
+
+// Allocates from the arena which was current when the allocator was created, or
+// from the heap if none was. Copies and moves keep the arena.
+template<typename T>
+struct ArenaAllocator {
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    Arena* arena;
+
+    ArenaAllocator() :
+        arena(currentArena())
+    {
+    }
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) :
+        arena(other.arena)
+    {
+    }
+
+    T* allocate(size_t n)
+    {
+        if (arena)
+            return static_cast<T*>(arena->allocate(n * sizeof(T)));
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        if (arena)
+            arena->deallocate(p, n * sizeof(T));
+        else
+            ::operator delete(p);
+    }
+};
+
+template<typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+    return a.arena == b.arena;
+}
+
+template<typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+    return a.arena != b.arena;
+}
+
+// Temporary container for FlexScan operations
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+} // namespace FlexScan
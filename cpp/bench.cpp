@@ -0,0 +1,753 @@
+// Copyright 2014 Todd Fleming
+//
+// This file is part of jscut.
+//
+// jscut is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// jscut is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with jscut.  If not, see <http://www.gnu.org/licenses/>.
+
+// Native benchmark for the exported kernels. Built by "make native"; not part
+// of the emscripten build.
+//
+// usage: cam-bench [--kernel name]... [--max-vertices n] [--threads n] [--csv] [--trace prefix] [--hatch] file.svg...
+//
+// Each file's <path d="..."> elements are flattened into polygons, cleaned,
+// oriented, then tiled in a square grid to build inputs from a few hundred to
+// millions of vertices.
+// Every run happens in a forked child so peak RSS belongs to that run alone.
+//
+// Besides the exported kernels, intersectEdges and intersectEdgesBoost split the
+// raw cutter offset of each case with FlexScan's splitter and with the older
+// boost validate_scan path, gcode writes the toolpath of an outline op
+// with tabs, and vPocketDepths reruns vPocket at 4 depths against one geometry
+// handle, as the UI does when only the depth changes. inset traces
+// medialAxisInset at 4 amounts and prints how each compares with offset():
+// polygon and vertex counts, time and area.
+//
+// --threads sets FlexScan's default execution policy; output doesn't depend on it.
+//
+// --hatch adds a generated corpus of long, nearly horizontal strips stacked closer than they
+// rise. It is the worst case for intersectEdges' band bucketing.
+//
+// When built with -DCAM_PROFILE, --trace writes a Chrome trace of each run to
+// <prefix><kernel>-<corpus>-<copies>.json.
+
+#define _USE_MATH_DEFINES
+
+#include "cam.h"
+#include "geometry.h"
+#include "offset.h"
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace cam;
+using namespace std;
+
+static const double pxPerInch = 90;
+
+struct SvgPathParser {
+    const string& d;
+    size_t pos = 0;
+
+    SvgPathParser(const string& d) :
+        d(d)
+    {
+    }
+
+    void skipSeparators()
+    {
+        while (pos < d.size() && (isspace(d[pos]) || d[pos] == ','))
+            ++pos;
+    }
+
+    bool atNumber()
+    {
+        skipSeparators();
+        return pos < d.size() && (isdigit(d[pos]) || d[pos] == '-' || d[pos] == '+' || d[pos] == '.');
+    }
+
+    bool atCommand()
+    {
+        skipSeparators();
+        return pos < d.size() && isalpha(d[pos]) && d[pos] != 'e' && d[pos] != 'E';
+    }
+
+    double number()
+    {
+        skipSeparators();
+        const char* begin = d.c_str() + pos;
+        char* end;
+        double result = strtod(begin, &end);
+        if (end == begin)
+            throw runtime_error("bad number in path data");
+        pos += end - begin;
+        return result;
+    }
+};
+
+struct Transform {
+    double a = 1, b = 0, c = 0, d = 1, e = 0, f = 0;
+
+    void apply(double& x, double& y) const
+    {
+        double nx = a * x + c * y + e;
+        double ny = b * x + d * y + f;
+        x = nx;
+        y = ny;
+    }
+};
+
+// Only handles a single translate(), scale(), or matrix() on the path element itself.
+static Transform parseTransform(const string& s)
+{
+    Transform t;
+    vector<double> args;
+    auto open = s.find('(');
+    if (open == string::npos)
+        return t;
+    istringstream in(s.substr(open + 1));
+    double v;
+    char sep;
+    while (in >> v) {
+        args.push_back(v);
+        in >> sep;
+        if (sep != ',')
+            in.putback(sep);
+    }
+    if (s.compare(0, 9, "translate") == 0 && !args.empty()) {
+        t.e = args[0];
+        t.f = args.size() > 1 ? args[1] : 0;
+    }
+    else if (s.compare(0, 5, "scale") == 0 && !args.empty()) {
+        t.a = args[0];
+        t.d = args.size() > 1 ? args[1] : args[0];
+    }
+    else if (s.compare(0, 6, "matrix") == 0 && args.size() == 6) {
+        t.a = args[0]; t.b = args[1]; t.c = args[2];
+        t.d = args[3]; t.e = args[4]; t.f = args[5];
+    }
+    return t;
+}
+
+// Flatten path data into polygons. Curves use a fixed number of segments; arcs become lines.
+static void flattenPath(PolygonSet& result, const string& d, const Transform& transform)
+{
+    const int curveSegments = 16;
+    SvgPathParser parser(d);
+    vector<pair<double, double>> points;
+    double x = 0, y = 0, startX = 0, startY = 0;
+    double lastCtrlX = 0, lastCtrlY = 0;
+    char cmd = 0;
+    char lastCmd = 0;
+
+    auto flush = [&]() {
+        if (points.size() >= 3) {
+            result.emplace_back();
+            for (auto& p: points) {
+                double px = p.first, py = p.second;
+                transform.apply(px, py);
+                Point q{(int)lround(px * inchToClipperScale / pxPerInch), (int)lround(py * inchToClipperScale / pxPerInch)};
+                if (result.back().empty() || result.back().back() != q)
+                    result.back().push_back(q);
+            }
+        }
+        points.clear();
+    };
+
+    auto cubic = [&](double c1x, double c1y, double c2x, double c2y, double ex, double ey) {
+        for (int i = 1; i <= curveSegments; ++i) {
+            double t = (double)i / curveSegments;
+            double u = 1 - t;
+            points.emplace_back(
+                u*u*u*x + 3*u*u*t*c1x + 3*u*t*t*c2x + t*t*t*ex,
+                u*u*u*y + 3*u*u*t*c1y + 3*u*t*t*c2y + t*t*t*ey);
+        }
+        lastCtrlX = c2x;
+        lastCtrlY = c2y;
+        x = ex;
+        y = ey;
+    };
+
+    auto quadratic = [&](double cx, double cy, double ex, double ey) {
+        for (int i = 1; i <= curveSegments; ++i) {
+            double t = (double)i / curveSegments;
+            double u = 1 - t;
+            points.emplace_back(u*u*x + 2*u*t*cx + t*t*ex, u*u*y + 2*u*t*cy + t*t*ey);
+        }
+        lastCtrlX = cx;
+        lastCtrlY = cy;
+        x = ex;
+        y = ey;
+    };
+
+    while (true) {
+        if (parser.atCommand())
+            cmd = d[parser.pos++];
+        else if (!parser.atNumber())
+            break;
+        bool rel = islower(cmd);
+        double ox = rel ? x : 0;
+        double oy = rel ? y : 0;
+        switch (toupper(cmd)) {
+        case 'M':
+            flush();
+            x = ox + parser.number();
+            y = oy + parser.number();
+            startX = x;
+            startY = y;
+            points.emplace_back(x, y);
+            cmd = rel ? 'l' : 'L';
+            break;
+        case 'L':
+            x = ox + parser.number();
+            y = oy + parser.number();
+            points.emplace_back(x, y);
+            break;
+        case 'H':
+            x = ox + parser.number();
+            points.emplace_back(x, y);
+            break;
+        case 'V':
+            y = oy + parser.number();
+            points.emplace_back(x, y);
+            break;
+        case 'C': {
+            double c1x = ox + parser.number(), c1y = oy + parser.number();
+            double c2x = ox + parser.number(), c2y = oy + parser.number();
+            double ex = ox + parser.number(), ey = oy + parser.number();
+            cubic(c1x, c1y, c2x, c2y, ex, ey);
+            break;
+        }
+        case 'S': {
+            double c1x = x, c1y = y;
+            if (toupper(lastCmd) == 'C' || toupper(lastCmd) == 'S') {
+                c1x = 2 * x - lastCtrlX;
+                c1y = 2 * y - lastCtrlY;
+            }
+            double c2x = ox + parser.number(), c2y = oy + parser.number();
+            double ex = ox + parser.number(), ey = oy + parser.number();
+            cubic(c1x, c1y, c2x, c2y, ex, ey);
+            break;
+        }
+        case 'Q': {
+            double cx = ox + parser.number(), cy = oy + parser.number();
+            double ex = ox + parser.number(), ey = oy + parser.number();
+            quadratic(cx, cy, ex, ey);
+            break;
+        }
+        case 'T': {
+            double cx = x, cy = y;
+            if (toupper(lastCmd) == 'Q' || toupper(lastCmd) == 'T') {
+                cx = 2 * x - lastCtrlX;
+                cy = 2 * y - lastCtrlY;
+            }
+            double ex = ox + parser.number(), ey = oy + parser.number();
+            quadratic(cx, cy, ex, ey);
+            break;
+        }
+        case 'A':
+            for (int i = 0; i < 5; ++i)
+                parser.number();
+            x = ox + parser.number();
+            y = oy + parser.number();
+            points.emplace_back(x, y);
+            break;
+        case 'Z':
+            flush();
+            x = startX;
+            y = startY;
+            break;
+        default:
+            throw runtime_error(string("unsupported path command: ") + cmd);
+        }
+        lastCmd = cmd;
+    }
+    flush();
+}
+
+static string getAttribute(const string& element, const string& name)
+{
+    string key = name + "=\"";
+    for (auto pos = element.find(key); pos != string::npos; pos = element.find(key, pos + 1)) {
+        if (pos && isspace(element[pos - 1])) {
+            auto begin = pos + key.size();
+            return element.substr(begin, element.find('"', begin) - begin);
+        }
+    }
+    return{};
+}
+
+static PolygonSet loadSvg(const string& filename)
+{
+    ifstream in(filename);
+    if (!in)
+        throw runtime_error("can't open " + filename);
+    stringstream ss;
+    ss << in.rdbuf();
+    string text = ss.str();
+
+    PolygonSet result;
+    for (auto pos = text.find("<path"); pos != string::npos; pos = text.find("<path", pos + 1)) {
+        auto end = text.find('>', pos);
+        string element = text.substr(pos, end - pos);
+        string d = getAttribute(element, "d");
+        if (!d.empty())
+            flattenPath(result, d, parseTransform(getAttribute(element, "transform")));
+    }
+    return result;
+}
+
+// SVG nonzero fill rule. The UI simplifies geometry the same way before running kernels.
+struct NonZeroWinding {
+    template<typename ScanlineEdge>
+    bool operator()(const ScanlineEdge& e) const {
+        return !e.exclude && (e.windingNumberBefore == 0) != (e.windingNumberAfter == 0);
+    }
+};
+
+static double signedArea(const Polygon& poly)
+{
+    double a = 0;
+    for (size_t i = 0; i < poly.size(); ++i) {
+        auto& p1 = poly[i];
+        auto& p2 = poly[(i + 1) % poly.size()];
+        a += (double)x(p1) * y(p2) - (double)x(p2) * y(p1);
+    }
+    return a / 2;
+}
+
+// Kernels treat counterclockwise as filled. Make outer boundaries counterclockwise and holes clockwise.
+static void orient(PolygonSet& ps)
+{
+    for (auto& poly: ps) {
+        int depth = 0;
+        for (auto& other: ps)
+            if (&other != &poly && boost::polygon::contains(other, poly.front(), false))
+                ++depth;
+        if ((signedArea(poly) > 0) != (depth % 2 == 0))
+            reverse(poly.begin(), poly.end());
+    }
+}
+
+static size_t countVertices(const PolygonSet& ps)
+{
+    size_t n = 0;
+    for (auto& poly: ps)
+        n += poly.size();
+    return n;
+}
+
+static double totalArea(const PolygonSet& ps)
+{
+    double a = 0;
+    for (auto& poly: ps)
+        a += signedArea(poly);
+    return a;
+}
+
+// Tile copies*copies instances of geometry, spaced by its bounding box
+static PolygonSet tile(const PolygonSet& geometry, int copies)
+{
+    int minX = numeric_limits<int>::max(), minY = numeric_limits<int>::max();
+    int maxX = numeric_limits<int>::min(), maxY = numeric_limits<int>::min();
+    for (auto& poly: geometry) {
+        for (auto& p: poly) {
+            minX = min(minX, x(p));
+            minY = min(minY, y(p));
+            maxX = max(maxX, x(p));
+            maxY = max(maxY, y(p));
+        }
+    }
+    int spacingX = (maxX - minX) * 11 / 10;
+    int spacingY = (maxY - minY) * 11 / 10;
+
+    PolygonSet result;
+    result.reserve(geometry.size() * copies * copies);
+    for (int i = 0; i < copies; ++i) {
+        for (int j = 0; j < copies; ++j) {
+            Point delta{i * spacingX, j * spacingY};
+            for (auto& poly: geometry) {
+                result.emplace_back();
+                for (auto& p: poly)
+                    result.back().push_back(p + delta);
+            }
+        }
+    }
+    return result;
+}
+
+// Synthetic corpus for --hatch: 200 long strips, each rising 8 inches over its 20 inch length
+// but only 0.2 inch from the next. The edges' y ranges overlap 40 neighbors and their x ranges
+// overlap all of them. The strips are wider than the cutter, so the offset edges don't cross.
+static PolygonSet hatch()
+{
+    const int numStrips = 200;
+    const int length = 20 * inchToClipperScale;
+    const int rise = 8 * inchToClipperScale;
+    const int height = int(lround(0.15 * inchToClipperScale));
+    const int spacing = int(lround(0.2 * inchToClipperScale));
+
+    PolygonSet result;
+    for (int i = 0; i < numStrips; ++i) {
+        int y0 = i * spacing;
+        result.push_back({{0, y0}, {length, y0 + rise}, {length, y0 + rise + height}, {0, y0 + height}});
+    }
+    return result;
+}
+
+// Holds PolygonSet in the flat format the kernels expect
+struct FlatInput {
+    unique_ptr<int, void(*)(void*)> block;
+
+    explicit FlatInput(const PolygonSet& ps) :
+        block(convertPathsToFlat(ps), free)
+    {
+    }
+
+    const int* get() const
+    {
+        return block.get();
+    }
+};
+
+struct Case {
+    string corpus;
+    int copies;
+    PolygonSet geometry;
+    size_t numVertices;
+};
+
+struct Result {
+    double seconds = 0;
+    long peakRssKb = 0;
+    size_t numOutputVertices = 0;
+    bool ok = false;
+};
+
+// Split the raw (self-intersecting) cutter offset of geometry, as offset() does before cleaning
+template<typename F>
+static size_t runIntersectEdges(const Case& c, double cutterDia, F intersectEdges)
+{
+    using Edge = FlexScan::Edge<Point, FlexScan::EdgeNext>;
+    using Scan = FlexScan::Scan<FlexScan::ScanlineEdge<Edge>>;
+
+    vector<Edge> edges;
+    auto raw = FlexScan::rawOffsetPolygonSet(c.geometry, -cutterDia / 2, arcTolerance, true);
+    Scan::insertPolygons(edges, raw.begin(), raw.end());
+    intersectEdges(edges);
+    return edges.size();
+}
+
+static size_t runKernel(const string& kernel, const Case& c)
+{
+    const double cutterDia = 0.125 * inchToClipperScale;
+    const double cutterAngle = 60;
+    const double passDepth = 0.125 * inchToClipperScale;
+    const double maxDepth = 0.25 * inchToClipperScale;
+
+    int* resultPaths = nullptr;
+
+    if (kernel == "intersectEdges") {
+        using Scan = FlexScan::Scan<FlexScan::ScanlineEdge<FlexScan::Edge<Point, FlexScan::EdgeNext>>>;
+        return runIntersectEdges(c, cutterDia, [](vector<Scan::Edge>& edges) {
+            Scan::intersectEdges(edges, edges.begin(), edges.end()); });
+    }
+    else if (kernel == "intersectEdgesBoost") {
+        using Scan = FlexScan::Scan<FlexScan::ScanlineEdge<FlexScan::Edge<Point, FlexScan::EdgeNext>>>;
+        return runIntersectEdges(c, cutterDia, [](vector<Scan::Edge>& edges) {
+            Scan::intersectEdgesBoost(edges, edges.begin(), edges.end()); });
+    }
+    else if (kernel == "hspocket") {
+        FlatInput in(c.geometry);
+        hspocket(in.get(), cutterDia, nullptr, resultPaths);
+    }
+    else if (kernel == "pocket" || kernel == "outline") {
+        FlatInput in(c.geometry);
+        int* safeToClose = nullptr;
+        if (kernel == "pocket")
+            pocket(in.get(), cutterDia, 0.5, false, resultPaths, safeToClose);
+        else
+            outline(in.get(), cutterDia, true, cutterDia * 2, 0.5, false, resultPaths, safeToClose);
+        free(safeToClose);
+    }
+    else if (kernel == "vPocket") {
+        FlatInput in(c.geometry);
+        vPocket(0, 0, in.get(), cutterAngle, passDepth, maxDepth, resultPaths);
+    }
+    else if (kernel == "vPocketDepths") {
+        FlatInput in(c.geometry);
+        int geometry = createGeometry(in.get());
+        for (int i = 1; i <= 4; ++i) {
+            free(resultPaths);
+            vPocketGeometry(0, 0, geometry, cutterAngle, passDepth, maxDepth * i / 4, resultPaths);
+        }
+        destroyGeometry(geometry);
+    }
+    else if (kernel == "vPocketFlat") {
+        // Floor cleared with a cutter 4x the size of hspocket's
+        FlatInput in(c.geometry);
+        int* floorPaths = nullptr;
+        vPocketFlat(0, 0, in.get(), cutterAngle, passDepth, maxDepth, cutterDia * 4, nullptr, resultPaths, floorPaths);
+        size_t numFloorVertices = floorPaths ? FlatPaths{floorPaths}.numPoints() : 0;
+        free(floorPaths);
+        if (!resultPaths)
+            return 0;
+        size_t numVertices = FlatPaths{resultPaths}.numPoints() + numFloorVertices;
+        free(resultPaths);
+        return numVertices;
+    }
+    else if (kernel == "inset") {
+        // medialAxisInset at 4 amounts from one diagram, each compared with offset() at the
+        // same amount on stderr. Output counts medialAxisInset's vertices.
+        MedialAxis medialAxis;
+        buildMedialAxis(c.geometry, medialAxis);
+        size_t numVertices = 0;
+        for (int i = 0; i < 4; ++i) {
+            double amount = cutterDia / 8 * (1 << i);
+            auto startTime = chrono::steady_clock::now();
+            auto inset = medialAxisInset(medialAxis, amount, arcTolerance);
+            double insetSeconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+            startTime = chrono::steady_clock::now();
+            PolygonSet offset;
+            {
+                FlexScan::ArenaScope arena;
+                offset = FlexScan::offset(c.geometry, -amount, arcTolerance, true);
+            }
+            double offsetSeconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+            double insetArea = totalArea(inset);
+            double offsetArea = totalArea(offset);
+            fprintf(stderr, "inset %s x%d amount %.0f: medialAxisInset %zu polygons %zu vertices %.1f ms, offset %zu polygons %zu vertices %.1f ms, area delta %+.4f%%\n",
+                c.corpus.c_str(), c.copies, amount,
+                inset.size(), countVertices(inset), insetSeconds * 1000,
+                offset.size(), countVertices(offset), offsetSeconds * 1000,
+                offsetArea ? (insetArea - offsetArea) / offsetArea * 100 : 0.0);
+            numVertices += countVertices(inset);
+        }
+        return numVertices;
+    }
+    else if (kernel == "separateTabs") {
+        // One long cut path through every polygon, with a tab over every other copy
+        Polygon cutPath;
+        for (auto& poly: c.geometry) {
+            cutPath.insert(cutPath.end(), poly.begin(), poly.end());
+            cutPath.push_back(poly.front());
+        }
+        PolygonSet tabs;
+        for (size_t i = 0; i < c.geometry.size(); i += 2) {
+            auto& p = c.geometry[i].front();
+            int r = cutterDia;
+            tabs.push_back({{x(p)-r, y(p)-r}, {x(p)+r, y(p)-r}, {x(p)+r, y(p)+r}, {x(p)-r, y(p)+r}});
+        }
+        FlatInput inPath(PolygonSet{move(cutPath)});
+        FlatInput inTabs(tabs);
+        int error = 0;
+        separateTabs(inPath.get(), inTabs.get(), error, resultPaths);
+    }
+    else if (kernel == "gcode") {
+        // Outline every polygon in 3 ramped passes, with tabs over every other copy.
+        // Counts output bytes instead of vertices.
+        vector<int> safeToClose;
+        vector<vector<PointWithZ>> paths;
+        PolygonSet tabs;
+        for (size_t i = 0; i < c.geometry.size(); ++i) {
+            auto& poly = c.geometry[i];
+            paths.emplace_back(poly.begin(), poly.end());
+            paths.back().push_back(poly.front());
+            safeToClose.push_back(1);
+            if (!(i & 1)) {
+                auto& p = poly.front();
+                int r = cutterDia;
+                tabs.push_back({{x(p)-r, y(p)-r}, {x(p)+r, y(p)-r}, {x(p)+r, y(p)+r}, {x(p)-r, y(p)+r}});
+            }
+        }
+        double options[gcodeNumOptions] = {};
+        options[gcodeRamp] = 1;
+        options[gcodeScale] = 25.4 / inchToClipperScale;
+        options[gcodeDecimal] = 4;
+        options[gcodeBotZ] = -3;
+        options[gcodeSafeZ] = 2.5;
+        options[gcodePassDepth] = 1;
+        options[gcodePlungeFeed] = 100;
+        options[gcodeRetractFeed] = 1000;
+        options[gcodeCutFeed] = 1000;
+        options[gcodeRapidFeed] = 2500;
+        options[gcodeTabZ] = -2;
+
+        unique_ptr<int, void(*)(void*)> inPaths(convertPathsToFlat(paths), free);
+        FlatInput inTabs(tabs);
+        char* gcode = nullptr;
+        int gcodeSize = 0;
+        int tabError = 0;
+        getGcode(inPaths.get(), safeToClose.data(), inTabs.get(), options, tabError, gcode, gcodeSize);
+        free(gcode);
+        return gcodeSize;
+    }
+    else
+        throw runtime_error("unknown kernel: " + kernel);
+
+    size_t numOutputVertices = resultPaths ? FlatPaths{resultPaths}.numPoints() : 0;
+    free(resultPaths);
+    return numOutputVertices;
+}
+
+static string tracePrefix;
+
+// Run kernel in a child process. The kernels print errors to stdout; the child discards them.
+static Result runIsolated(const string& kernel, const Case& c)
+{
+    Result result;
+    int fds[2];
+    if (pipe(fds))
+        return result;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0)
+        return result;
+    if (pid == 0) {
+        close(fds[0]);
+        int devNull = open("/dev/null", O_WRONLY);
+        dup2(devNull, 1);
+#ifdef CAM_PROFILE
+        profile::current().clear();
+#endif
+        auto startTime = chrono::steady_clock::now();
+        result.numOutputVertices = runKernel(kernel, c);
+        result.seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+        result.ok = true;
+#ifdef CAM_PROFILE
+        if (!tracePrefix.empty()) {
+            string filename = tracePrefix + kernel + "-" + c.corpus + "-" + to_string(c.copies) + ".json";
+            ofstream(filename) << profile::current().toChromeTrace();
+        }
+#endif
+        if (write(fds[1], &result, sizeof(result)) != sizeof(result))
+            _exit(1);
+        _exit(0);
+    }
+
+    close(fds[1]);
+    if (read(fds[0], &result, sizeof(result)) != sizeof(result))
+        result.ok = false;
+    close(fds[0]);
+    int status;
+    rusage usage;
+    wait4(pid, &status, 0, &usage);
+    result.peakRssKb = usage.ru_maxrss;
+    if (!WIFEXITED(status) || WEXITSTATUS(status))
+        result.ok = false;
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    vector<string> kernels;
+    vector<string> files;
+    size_t maxVertices = 1000000;
+    bool csv = false;
+    bool useHatch = false;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--kernel" && i + 1 < argc)
+            kernels.push_back(argv[++i]);
+        else if (arg == "--max-vertices" && i + 1 < argc)
+            maxVertices = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--threads" && i + 1 < argc)
+            FlexScan::defaultExecutionPolicy().numThreads = max(1, atoi(argv[++i]));
+        else if (arg == "--csv")
+            csv = true;
+        else if (arg == "--hatch")
+            useHatch = true;
+        else if (arg == "--trace" && i + 1 < argc)
+            tracePrefix = argv[++i];
+        else if (arg.compare(0, 2, "--") == 0) {
+            fprintf(stderr, "usage: %s [--kernel intersectEdges|intersectEdgesBoost|hspocket|pocket|outline|vPocket|vPocketDepths|vPocketFlat|inset|separateTabs|gcode]... [--max-vertices n] [--threads n] [--csv] [--trace prefix] [--hatch] file.svg...\n", argv[0]);
+            return 1;
+        }
+        else
+            files.push_back(arg);
+    }
+    if (kernels.empty())
+        kernels = {"intersectEdges", "intersectEdgesBoost", "separateTabs", "hspocket", "pocket", "outline", "vPocket", "vPocketDepths", "vPocketFlat", "gcode"};
+#ifndef CAM_PROFILE
+    if (!tracePrefix.empty()) {
+        fprintf(stderr, "%s: --trace needs a build with -DCAM_PROFILE\n", argv[0]);
+        return 1;
+    }
+#endif
+    if (files.empty() && !useHatch) {
+        fprintf(stderr, "%s: no input files\n", argv[0]);
+        return 1;
+    }
+
+    vector<Case> cases;
+    for (auto& file: files) {
+        PolygonSet geometry;
+        try {
+            geometry = FlexScan::cleanPolygonSet(loadSvg(file), NonZeroWinding{});
+            orient(geometry);
+        }
+        catch (exception& e) {
+            fprintf(stderr, "%s: %s\n", file.c_str(), e.what());
+            return 1;
+        }
+        size_t baseVertices = countVertices(geometry);
+        if (!baseVertices) {
+            fprintf(stderr, "%s: no paths\n", file.c_str());
+            return 1;
+        }
+        string name = file.substr(file.find_last_of('/') + 1);
+        for (int copies = 1; baseVertices * copies * copies <= maxVertices; copies *= 2)
+            cases.push_back({name, copies * copies, tile(geometry, copies), baseVertices * copies * copies});
+    }
+    if (useHatch) {
+        auto geometry = hatch();
+        size_t baseVertices = countVertices(geometry);
+        for (int copies = 1; baseVertices * copies * copies <= maxVertices; copies *= 2)
+            cases.push_back({"hatch", copies * copies, tile(geometry, copies), baseVertices * copies * copies});
+    }
+
+    if (csv)
+        printf("kernel,corpus,copies,vertices,outputVertices,seconds,peakRssKb,verticesPerSecond\n");
+    else
+        printf("%-19s %-16s %7s %10s %10s %10s %10s %12s\n", "kernel", "corpus", "copies", "vertices", "output", "wall ms", "peak MB", "vertices/s");
+
+    bool allOk = true;
+    for (auto& kernel: kernels) {
+        for (auto& c: cases) {
+            Result r = runIsolated(kernel, c);
+            allOk = allOk && r.ok;
+            double rate = r.seconds > 0 ? c.numVertices / r.seconds : 0;
+            if (csv) {
+                printf("%s,%s,%d,%zu,%zu,%.6f,%ld,%.0f\n",
+                    kernel.c_str(), c.corpus.c_str(), c.copies, c.numVertices, r.numOutputVertices, r.seconds, r.peakRssKb, rate);
+            }
+            else if (r.ok) {
+                printf("%-19s %-16s %7d %10zu %10zu %10.1f %10.1f %12.0f\n",
+                    kernel.c_str(), c.corpus.c_str(), c.copies, c.numVertices, r.numOutputVertices, r.seconds * 1000, r.peakRssKb / 1024.0, rate);
+            }
+            else {
+                printf("%-19s %-16s %7d %10zu %10s\n", kernel.c_str(), c.corpus.c_str(), c.copies, c.numVertices, "FAILED");
+            }
+            fflush(stdout);
+        }
+    }
+    return allOk ? 0 : 1;
+}
@@ -18,81 +18,336 @@
 #define _USE_MATH_DEFINES
 
 #include "cam.h"
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <new>
+
+#ifdef CAM_PROFILE
+#include <cstring>
+#include <mutex>
+#endif
 
 using namespace cam;
 
-// Convert paths to C format
-void cam::convertPathsToC(
-    double**& cPaths, int& cNumPaths, int*& cPathSizes,
-    const PolygonSet& paths, bool includeDummyZ
-    )
-{
-    //!!!! don't need double
-    int stride = includeDummyZ ? 3 : 2;
-    cPaths = (double**)malloc(paths.size() * sizeof(double*));
-    cNumPaths = paths.size();
-    cPathSizes = (int*)malloc(paths.size() * sizeof(int));
+// Allocate a flat block and fill in its header and offsets
+template<typename Paths>
+static int* allocFlatPaths(const Paths& paths, bool hasZ)
+{
+    size_t numPoints = 0;
+    for (auto& path: paths)
+        numPoints += path.size();
+    size_t size = 2 + paths.size() + 1 + numPoints * (hasZ ? 3 : 2);
+    int* block = (int*)malloc(size * sizeof(int));
+    if (!block)
+        throw std::bad_alloc();
+    block[0] = paths.size();
+    block[1] = hasZ;
+    int* offsets = block + 2;
+    int pos = 0;
     for (size_t i = 0; i < paths.size(); ++i) {
-        const Polygon& path = paths[i];
-        cPathSizes[i] = path.size();
-        char* pathStorage = (char*)malloc(path.size() * stride * sizeof(double) + sizeof(double) / 2);
-        // cPaths[i] contains the unaligned block so the javascript side can free it properly.
-        cPaths[i] = (double*)pathStorage;
-        if ((int)pathStorage & 4)
-            pathStorage += 4;
-        double* p = (double*)pathStorage;
-        for (size_t j = 0; j < path.size(); ++j) {
-            p[j*stride] = x(path[j]);
-            p[j*stride+1] = y(path[j]);
-            if (includeDummyZ)
-                p[j*stride+2] = 0;
+        offsets[i] = pos;
+        pos += paths[i].size();
+    }
+    offsets[paths.size()] = pos;
+    return block;
+}
+
+// Convert paths to flat format
+int* cam::convertPathsToFlat(const PolygonSet& paths, bool includeDummyZ)
+{
+    CAM_PROFILE_ZONE("convertPathsToFlat");
+    int* block = allocFlatPaths(paths, includeDummyZ);
+    FlatPaths flat{block};
+    int* coords = const_cast<int*>(flat.coords());
+    for (auto& path: paths) {
+        for (auto& point: path) {
+            *coords++ = x(point);
+            *coords++ = y(point);
         }
     }
+    if (includeDummyZ)
+        std::fill(coords, coords + flat.numPoints(), 0);
+    CAM_PROFILE_COUNT("convertPathsToFlat.points", flat.numPoints());
+    return block;
 }
 
-// Convert paths to C format
-void cam::convertPathsToC(
-    double**& cPaths, int& cNumPaths, int*& cPathSizes,
-    const std::vector<std::vector<PointWithZ>>& paths
-    )
+// Convert paths to flat format
+int* cam::convertPathsToFlat(const std::vector<std::vector<PointWithZ>>& paths)
 {
-    //!!!! don't need double
-    printf("ma: %d->%d\n", paths.size(), paths.size() * sizeof(double*));
-    cPaths = (double**)malloc(paths.size() * sizeof(double*));
-    cNumPaths = paths.size();
-    printf("mb: %d->%d\n", paths.size(), paths.size() * sizeof(int));
-    cPathSizes = (int*)malloc(paths.size() * sizeof(int));
-    for (size_t i = 0; i < paths.size(); ++i) {
-        const auto& path = paths[i];
-        cPathSizes[i] = path.size();
-        //printf("mc: %d->%d\n", path.size(), path.size() * 3 * sizeof(double) + sizeof(double) / 2);
-        char* pathStorage = (char*)malloc(path.size() * 3 * sizeof(double) + sizeof(double) / 2);
-        // cPaths[i] contains the unaligned block so the javascript side can free it properly.
-        cPaths[i] = (double*)pathStorage;
-        if ((int)pathStorage & 4)
-            pathStorage += 4;
-        double* p = (double*)pathStorage;
-        for (size_t j = 0; j < path.size(); ++j) {
-            p[j*3] = path[j].x;
-            p[j*3+1] = path[j].y;
-            p[j*3+2] = path[j].z;
+    CAM_PROFILE_ZONE("convertPathsToFlat");
+    int* block = allocFlatPaths(paths, true);
+    FlatPaths flat{block};
+    int* coords = const_cast<int*>(flat.coords());
+    int* z = const_cast<int*>(flat.z());
+    for (auto& path: paths) {
+        for (auto& point: path) {
+            *coords++ = point.x;
+            *coords++ = point.y;
+            *z++ = point.z;
         }
     }
-    printf("m done\n");
+    CAM_PROFILE_COUNT("convertPathsToFlat.points", flat.numPoints());
+    return block;
 }
 
-PolygonSet cam::convertPathsFromC(
-    double** paths, int numPaths, int* pathSizes)
+PolygonSet cam::convertPathsFromFlat(const int* paths)
 {
-    //!!!! don't need double
-    PolygonSet geometry;
-    for (int i = 0; i < numPaths; ++i) {
-        geometry.push_back({});
-        auto& newPath = geometry.back();
-        double* p = paths[i];
-        int l = pathSizes[i];
-        for (int j = 0; j < l; ++j)
-            newPath.push_back({lround(p[j*2]), lround(p[j*2+1])});
+    CAM_PROFILE_ZONE("convertPathsFromFlat");
+    FlatPaths flat{paths};
+    const int* coords = flat.coords();
+    PolygonSet geometry(flat.numPaths());
+    for (int i = 0; i < flat.numPaths(); ++i) {
+        auto& path = geometry[i];
+        path.reserve(flat.offsets()[i + 1] - flat.offsets()[i]);
+        for (int j = flat.offsets()[i]; j < flat.offsets()[i + 1]; ++j)
+            path.emplace_back(coords[j * 2], coords[j * 2 + 1]);
     }
     return geometry;
 }
+
+cam::PathSink::PathSink(PathsCallback callback, void* context, bool hasZ, size_t chunkPoints) :
+    callback(callback),
+    context(context),
+    hasZ(hasZ),
+    chunkPoints(chunkPoints)
+{
+    clear();
+}
+
+cam::PathSink::PathSink(bool hasZ) :
+    hasZ(hasZ),
+    chunkPoints(std::numeric_limits<size_t>::max())
+{
+    clear();
+}
+
+void cam::PathSink::add(const Polygon& path)
+{
+    for (auto& point: path) {
+        coords.push_back(x(point));
+        coords.push_back(y(point));
+        if (hasZ)
+            z.push_back(0);
+    }
+    endPath();
+}
+
+void cam::PathSink::add(const std::vector<PointWithZ>& path)
+{
+    for (auto& point: path) {
+        coords.push_back(point.x);
+        coords.push_back(point.y);
+        if (hasZ)
+            z.push_back(point.z);
+    }
+    endPath();
+}
+
+void cam::PathSink::add(const PolygonSet& paths)
+{
+    for (auto& path: paths)
+        add(path);
+}
+
+void cam::PathSink::addPoint(const PointWithZ& point)
+{
+    coords.push_back(point.x);
+    coords.push_back(point.y);
+    if (hasZ)
+        z.push_back(point.z);
+}
+
+void cam::PathSink::flush()
+{
+    if (!callback || offsets.size() == 1)
+        return;
+    CAM_PROFILE_ZONE("PathSink::flush");
+    block.resize(blockSize());
+    writeBlock(block.data());
+    clear();
+    callback(context, block.data());
+}
+
+int* cam::PathSink::release()
+{
+    int* result = (int*)malloc(blockSize() * sizeof(int));
+    if (!result)
+        throw std::bad_alloc();
+    writeBlock(result);
+    clear();
+    return result;
+}
+
+size_t cam::PathSink::blockSize() const
+{
+    return 2 + offsets.size() + coords.size() + z.size();
+}
+
+void cam::PathSink::writeBlock(int* dest) const
+{
+    *dest++ = offsets.size() - 1;
+    *dest++ = hasZ;
+    dest = std::copy(offsets.begin(), offsets.end(), dest);
+    dest = std::copy(coords.begin(), coords.end(), dest);
+    std::copy(z.begin(), z.end(), dest);
+}
+
+void cam::PathSink::clear()
+{
+    offsets.assign(1, 0);
+    coords.clear();
+    z.clear();
+}
+
+void cam::PathSink::endPath()
+{
+    offsets.push_back(coords.size() / 2);
+    if (coords.size() / 2 >= chunkPoints)
+        flush();
+}
+
+#ifdef CAM_PROFILE
+
+namespace {
+    std::mutex profileMutex;
+    cam::profile::Profile profileData;
+    std::chrono::high_resolution_clock::time_point profileEpoch = std::chrono::high_resolution_clock::now();
+    int profileNumThreads = 0;
+    thread_local int profileThread = -1;
+    thread_local int profileDepth = 0;
+
+    double profileUs(std::chrono::high_resolution_clock::duration d) {
+        return std::chrono::duration<double, std::micro>(d).count();
+    }
+
+    void appendJsonString(std::string& s, const char* str) {
+        s += '"';
+        for (; *str; ++str) {
+            if (*str == '"' || *str == '\\')
+                s += '\\';
+            s += *str;
+        }
+        s += '"';
+    }
+}
+
+double cam::profile::Profile::totalMs(const char* name) const
+{
+    double us = 0;
+    for (auto& zone: zones)
+        if (!strcmp(zone.name, name))
+            us += zone.durationUs;
+    return us / 1000;
+}
+
+int cam::profile::Profile::numCalls(const char* name) const
+{
+    int n = 0;
+    for (auto& zone: zones)
+        if (!strcmp(zone.name, name))
+            ++n;
+    return n;
+}
+
+long long cam::profile::Profile::counter(const char* name) const
+{
+    for (auto& c: counters)
+        if (!strcmp(c.name, name))
+            return c.value;
+    return 0;
+}
+
+void cam::profile::Profile::clear()
+{
+    zones.clear();
+    counters.clear();
+}
+
+std::string cam::profile::Profile::toJson() const
+{
+    char buf[128];
+    std::string s = "{\"zones\":[";
+    for (size_t i = 0; i < zones.size(); ++i) {
+        auto& zone = zones[i];
+        if (i)
+            s += ',';
+        s += "{\"name\":";
+        appendJsonString(s, zone.name);
+        snprintf(buf, sizeof(buf), ",\"thread\":%d,\"depth\":%d,\"startUs\":%.1f,\"durationUs\":%.1f}",
+            zone.thread, zone.depth, zone.startUs, zone.durationUs);
+        s += buf;
+    }
+    s += "],\"counters\":{";
+    for (size_t i = 0; i < counters.size(); ++i) {
+        if (i)
+            s += ',';
+        appendJsonString(s, counters[i].name);
+        snprintf(buf, sizeof(buf), ":%lld", counters[i].value);
+        s += buf;
+    }
+    s += "}}";
+    return s;
+}
+
+std::string cam::profile::Profile::toChromeTrace() const
+{
+    char buf[128];
+    double endUs = 0;
+    std::string s = "{\"traceEvents\":[";
+    for (size_t i = 0; i < zones.size(); ++i) {
+        auto& zone = zones[i];
+        if (i)
+            s += ',';
+        s += "{\"name\":";
+        appendJsonString(s, zone.name);
+        snprintf(buf, sizeof(buf), ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.1f,\"dur\":%.1f}",
+            zone.thread, zone.startUs, zone.durationUs);
+        s += buf;
+        endUs = std::max(endUs, zone.startUs + zone.durationUs);
+    }
+    for (size_t i = 0; i < counters.size(); ++i) {
+        if (i || !zones.empty())
+            s += ',';
+        s += "{\"name\":";
+        appendJsonString(s, counters[i].name);
+        snprintf(buf, sizeof(buf), ",\"ph\":\"C\",\"pid\":1,\"ts\":%.1f,\"args\":{\"value\":%lld}}", endUs, counters[i].value);
+        s += buf;
+    }
+    s += "]}";
+    return s;
+}
+
+cam::profile::Profile& cam::profile::current()
+{
+    return profileData;
+}
+
+int cam::profile::enterZone()
+{
+    return profileDepth++;
+}
+
+void cam::profile::recordZone(const char* name, std::chrono::high_resolution_clock::time_point start, int depth)
+{
+    auto now = std::chrono::high_resolution_clock::now();
+    --profileDepth;
+    std::lock_guard<std::mutex> lock(profileMutex);
+    if (profileThread < 0)
+        profileThread = profileNumThreads++;
+    profileData.zones.push_back({name, profileThread, depth, profileUs(start - profileEpoch), profileUs(now - start)});
+}
+
+void cam::profile::count(const char* name, long long n)
+{
+    std::lock_guard<std::mutex> lock(profileMutex);
+    for (auto& c: profileData.counters) {
+        if (!strcmp(c.name, name)) {
+            c.value += n;
+            return;
+        }
+    }
+    profileData.counters.push_back({name, n});
+}
+
+#endif // CAM_PROFILE
@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include "profile.h"
 #include <boost/polygon/polygon.hpp>
 
 namespace cam {
@@ -116,21 +117,228 @@ namespace cam {
         return a;
     }
 
-    // Convert paths to C format
-    void convertPathsToC(
-        double**& cPaths, int& cNumPaths, int*& cPathSizes,
-        const PolygonSet& paths, bool includeDummyZ = false);
+    // Flat path format shared with javascript. One int32 block:
+    //      [numPaths, hasZ, offsets[0..numPaths], x0, y0, x1, y1, ..., z0, z1, ...]
+    // Path i is points offsets[i] to offsets[i+1]; offsets[numPaths] is the number of
+    // points. Z values follow the coordinates when hasZ is set. It is a single malloc
+    // block, so javascript reads it through one typed array and frees it with one call.
+    struct FlatPaths {
+        const int* block;
+
+        int numPaths() const { return block[0]; }
+        bool hasZ() const { return block[1] != 0; }
+        const int* offsets() const { return block + 2; }
+        int numPoints() const { return offsets()[numPaths()]; }
+        const int* coords() const { return offsets() + numPaths() + 1; }
+        const int* z() const { return coords() + 2 * numPoints(); }
+    };
+
+    // Convert paths to flat format. Free the result with free().
+    int* convertPathsToFlat(const PolygonSet& paths, bool includeDummyZ = false);
+
+    // Convert paths to flat format. Free the result with free().
+    int* convertPathsToFlat(const std::vector<std::vector<PointWithZ>>& paths);
+
+    // Convert paths from flat format; ignores Z
+    PolygonSet convertPathsFromFlat(const int* paths);
+
+    // Split paths where they cross into or out of tabs. Pieces alternate between off-tab
+    // and over-tab, starting off-tab. On failure sets error and returns paths.
+    PolygonSet separateTabPaths(const PolygonSet& paths, const PolygonSet& tabs, bool& error);
+
+    // Receives output paths as a kernel produces them. paths is a flat block which is
+    // only valid during the call.
+    typedef void (*PathsCallback)(void* context, const int* paths);
+
+    // Output paths of a kernel. Streaming sinks pass paths to a callback in chunks of
+    // about chunkPoints points as they arrive, so memory stays bounded by the chunk
+    // size. Collecting sinks keep everything for release().
+    class PathSink {
+    public:
+        static const size_t defaultChunkPoints = 1 << 16;
+
+        // Streams to callback
+        PathSink(PathsCallback callback, void* context, bool hasZ, size_t chunkPoints = defaultChunkPoints);
+
+        // Collects for release()
+        explicit PathSink(bool hasZ);
 
-    // Convert paths to C format
-    void convertPathsToC(
-        double**& cPaths, int& cNumPaths, int*& cPathSizes,
-        const std::vector<std::vector<PointWithZ>>& paths);
+        PathSink(const PathSink&) = delete;
+        PathSink& operator=(const PathSink&) = delete;
 
-    // Convert paths from C format
-    PolygonSet convertPathsFromC(
-        double** paths, int numPaths, int* pathSizes);
+        void add(const Polygon& path);
+        void add(const std::vector<PointWithZ>& path);
+        void add(const PolygonSet& paths);
+
+        // Add a path a point at a time; endPath() finishes it
+        void addPoint(const PointWithZ& point);
+        void endPath();
+
+        // Pass any paths not yet delivered to the callback
+        void flush();
+
+        // Collected paths in flat format. Free the result with free().
+        int* release();
+
+    private:
+        PathsCallback callback = nullptr;
+        void* context = nullptr;
+        bool hasZ;
+        size_t chunkPoints;
+        std::vector<int> offsets;
+        std::vector<int> coords;
+        std::vector<int> z;
+        std::vector<int> block;
+
+        size_t blockSize() const;
+        void writeBlock(int* dest) const;
+        void clear();
+    };
+
+    // hspocket's work; cutter paths go to sink. safeArea is the geometry inset by the
+    // cutter radius. options is as for hspocket().
+    void hspocketPaths(const PolygonSet& safeArea, double cutterDia, const double* options, PathSink& sink);
 }
 
+// Option slots in hspocket()'s options array, in clipper units. NaN, or a null options
+// array, selects the default. Without a start point each region's first spiral starts at
+// the center of its largest inscribed circle.
+enum HspocketOption {
+    hspocketStartX,             // Center of the first spiral
+    hspocketStartY,
+    hspocketStepover,           // Maximum engagement: distance between layers (cutterDia / 4)
+    hspocketMinRadius,          // Skip features narrower than 2 * minRadius (cutterDia / 8)
+    hspocketMinProgress,        // Minimum engagement: skip front advancing less (stepover / 8)
+    hspocketRasterCellSize,     // Resolution of the cut area raster; 0 disables it (minProgress / 2)
+    hspocketNumOptions,
+};
+
+// Entry points exported to javascript. Native builds (benchmarks) call these directly.
+// Paths are in flat format (FlatPaths). Each sets resultPaths to a block the caller frees,
+// or to nullptr if it fails. The *Stream versions pass paths to callback in chunks as
+// they're produced instead.
+extern "C" void hspocket(
+    const int* paths, double cutterDia, const double* options,
+    int*& resultPaths);
+
+extern "C" void hspocketStream(
+    const int* paths, double cutterDia, const double* options,
+    cam::PathsCallback callback, void* context);
+
+// Conventional pocket and outline. overlap is in [0, 1); climb and isInside are booleans.
+// Rings are linked into longer cuts where the link stays in the cleared area. Also sets
+// resultSafeToClose to a block the caller frees, with an entry per path: can the path be
+// closed without retracting?
+extern "C" void pocket(
+    const int* paths, double cutterDia, double overlap, int climb,
+    int*& resultPaths, int*& resultSafeToClose);
+
+extern "C" void outline(
+    const int* paths, double cutterDia, int isInside, double width, double overlap, int climb,
+    int*& resultPaths, int*& resultSafeToClose);
+
+extern "C" void separateTabs(
+    const int* pathPolygons, const int* tabPolygons,
+    int& error,
+    int*& resultPaths);
+
+extern "C" void vPocket(
+    int debugArg0, int debugArg1,
+    const int* paths,
+    double cutterAngle, double passDepth, double maxDepth,
+    int*& resultPaths);
+
+extern "C" void vPocketStream(
+    int debugArg0, int debugArg1,
+    const int* paths,
+    double cutterAngle, double passDepth, double maxDepth,
+    cam::PathsCallback callback, void* context);
+
+// Geometry handles. createGeometry copies paths (flat format) and returns a handle, or 0 if
+// it fails. The *Geometry entry points run against a handle and keep what they derive from
+// it (Voronoi diagram, offsets, edge index) for the next call, so rerunning an operation
+// with other settings skips that work. setGeometry replaces the paths and drops the derived
+// data; destroyGeometry frees everything. Unknown handles produce no paths.
+extern "C" int createGeometry(const int* paths);
+
+extern "C" void setGeometry(int geometry, const int* paths);
+
+extern "C" void destroyGeometry(int geometry);
+
+extern "C" void hspocketGeometry(
+    int geometry, double cutterDia, const double* options,
+    int*& resultPaths);
+
+extern "C" void hspocketGeometryStream(
+    int geometry, double cutterDia, const double* options,
+    cam::PathsCallback callback, void* context);
+
+// Sets error if tabGeometry isn't a handle
+extern "C" void separateTabsGeometry(
+    const int* pathPolygons, int tabGeometry,
+    int& error,
+    int*& resultPaths);
+
+extern "C" void vPocketGeometry(
+    int debugArg0, int debugArg1,
+    int geometry,
+    double cutterAngle, double passDepth, double maxDepth,
+    int*& resultPaths);
+
+extern "C" void vPocketGeometryStream(
+    int debugArg0, int debugArg1,
+    int geometry,
+    double cutterAngle, double passDepth, double maxDepth,
+    cam::PathsCallback callback, void* context);
+
+// V-carve with a flat bottom, for carves too wide to reach full depth. The V cutter's paths
+// stop at maxDepth (resultPaths). Where the carve would go deeper, a flat cutter of
+// flatCutterDia clears the floor first with hspocket, stepping down by passDepth
+// (resultFloorPaths). options is as for hspocket().
+extern "C" void vPocketFlat(
+    int debugArg0, int debugArg1,
+    const int* paths,
+    double cutterAngle, double passDepth, double maxDepth,
+    double flatCutterDia, const double* options,
+    int*& resultPaths, int*& resultFloorPaths);
+
+extern "C" void vPocketFlatGeometry(
+    int debugArg0, int debugArg1,
+    int geometry,
+    double cutterAngle, double passDepth, double maxDepth,
+    double flatCutterDia, const double* options,
+    int*& resultPaths, int*& resultFloorPaths);
+
+// Option slots in getGcode()'s options array. See cam::GcodeOptions.
+enum GcodeOption {
+    gcodeRamp,
+    gcodeScale,
+    gcodeUseZ,
+    gcodeOffsetX,
+    gcodeOffsetY,
+    gcodeDecimal,
+    gcodeTopZ,
+    gcodeBotZ,
+    gcodeSafeZ,
+    gcodePassDepth,
+    gcodePlungeFeed,
+    gcodeRetractFeed,
+    gcodeCutFeed,
+    gcodeRapidFeed,
+    gcodeTabZ,
+    gcodeNumOptions,
+};
+
+// Gcode for paths (flat format; Z is 0 if absent). safeToClose has one entry per path.
+// tabGeometry may be empty. Sets result to text the caller frees (not 0-terminated), or
+// to nullptr if it fails. Sets tabError if tabs couldn't be separated from a path; that
+// path is cut without tabs, as separateTabs() leaves it.
+extern "C" void getGcode(
+    const int* paths, const int* safeToClose, const int* tabGeometry,
+    const double* options,
+    int& tabError,
+    char*& result, int& resultSize);
+
 namespace boost {
     namespace polygon {
         template <>
@@ -0,0 +1,186 @@
+// Copyright 2014 Todd Fleming
+//
+// This file is part of jscut.
+//
+// jscut is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// jscut is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with jscut.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "cam.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace cam {
+
+// Approximate cut area as a bit per cell. A cell is cut once its center is within the
+// cutter radius of a stamped path. Rows are packed 64 cells to a word; stamping and
+// queries work on whole words, so a swept circle costs O(length / cellSize) word
+// operations however much area it covers.
+//
+// Queries answer "would this cut anything new?" without polygon booleans. Cells outside
+// the bounds are ignored.
+class CutRaster {
+public:
+    // Covers [low, high]. cellSize grows if needed to keep the grid within maxCells.
+    CutRaster(Point low, Point high, double cellSize, size_t maxCells = size_t(1) << 26) :
+        x0(x(low)),
+        y0(y(low))
+    {
+        double w = std::max(1.0, (double)x(high) - x(low));
+        double h = std::max(1.0, (double)y(high) - y(low));
+        cell = std::max({cellSize, 1.0, std::sqrt(w * h / maxCells)});
+        width = int(std::ceil(w / cell)) + 1;
+        height = int(std::ceil(h / cell)) + 1;
+        wordsPerRow = (width + 63) / 64;
+        bits.assign(wordsPerRow * height, 0);
+    }
+
+    double cellSize() const
+    {
+        return cell;
+    }
+
+    // Mark cells within radius of path
+    void stamp(const Polygon& path, double radius)
+    {
+        if (path.size() == 1)
+            stampSegment(path[0], path[0], radius);
+        for (size_t i = 0; i + 1 < path.size(); ++i)
+            stampSegment(path[i], path[i + 1], radius);
+    }
+
+    void stampSegment(Point a, Point b, double radius)
+    {
+        forEachRow(a, b, radius, [this](size_t rowBegin, int i0, int i1) {
+            uint64_t* row = &bits[rowBegin];
+            int w0 = i0 >> 6, w1 = i1 >> 6;
+            if (w0 == w1) {
+                row[w0] |= rangeMask(i0 & 63, i1 & 63);
+                return false;
+            }
+            row[w0] |= ~uint64_t(0) << (i0 & 63);
+            for (int w = w0 + 1; w < w1; ++w)
+                row[w] = ~uint64_t(0);
+            row[w1] |= ~uint64_t(0) >> (63 - (i1 & 63));
+            return false;
+        });
+    }
+
+    // Would a cutter of radius swept from a to b reach any cell which isn't cut yet?
+    bool segmentCutsNew(Point a, Point b, double radius) const
+    {
+        bool found = false;
+        forEachRow(a, b, radius, [this, &found](size_t rowBegin, int i0, int i1) {
+            const uint64_t* row = &bits[rowBegin];
+            int w0 = i0 >> 6, w1 = i1 >> 6;
+            if (w0 == w1)
+                found = (~row[w0] & rangeMask(i0 & 63, i1 & 63)) != 0;
+            else {
+                found = (~row[w0] & (~uint64_t(0) << (i0 & 63))) != 0;
+                for (int w = w0 + 1; !found && w < w1; ++w)
+                    found = ~row[w] != 0;
+                found = found || (~row[w1] & (~uint64_t(0) >> (63 - (i1 & 63)))) != 0;
+            }
+            return found;
+        });
+        return found;
+    }
+
+private:
+    double x0;
+    double y0;
+    double cell;
+    int width;
+    int height;
+    size_t wordsPerRow;
+    std::vector<uint64_t> bits;
+
+    // Bits lo through hi
+    static uint64_t rangeMask(int lo, int hi)
+    {
+        return (~uint64_t(0) << lo) & (~uint64_t(0) >> (63 - hi));
+    }
+
+    // Call f(rowBegin, i0, i1) for each row holding cells [i0, i1] whose centers are
+    // within radius of segment ab. rowBegin indexes the row's first word in bits. Stops
+    // early if f returns true.
+    template<typename F>
+    void forEachRow(Point a, Point b, double radius, F f) const
+    {
+        // Cell coordinates; cell i's center is at i
+        double ax = (x(a) - x0) / cell - 0.5, ay = (y(a) - y0) / cell - 0.5;
+        double bx = (x(b) - x0) / cell - 0.5, by = (y(b) - y0) / cell - 0.5;
+        double r = radius / cell;
+        double dx = bx - ax, dy = by - ay;
+        double len2 = dx * dx + dy * dy;
+
+        int j0 = std::max(0, int(std::ceil(std::min(ay, by) - r)));
+        int j1 = std::min(height - 1, int(std::floor(std::max(ay, by) + r)));
+        for (int j = j0; j <= j1; ++j) {
+            // The capsule is convex, so each row crosses it in one interval: the union of
+            // the end circles' chords and the band between them
+            double lo = INFINITY, hi = -INFINITY;
+            auto circle = [&](double cx, double cy) {
+                double h2 = r * r - (j - cy) * (j - cy);
+                if (h2 >= 0) {
+                    double h = std::sqrt(h2);
+                    lo = std::min(lo, cx - h);
+                    hi = std::max(hi, cx + h);
+                }
+            };
+            circle(ax, ay);
+            circle(bx, by);
+            if (len2 > 0 && dy != 0) {
+                // |cross(d, p - a)| <= r * len and 0 <= dot(d, p - a) <= len2, for p = (x, j)
+                double len = std::sqrt(len2);
+                double c = dx * (j - ay);
+                double bandLo = ax + (c - r * len) / dy, bandHi = ax + (c + r * len) / dy;
+                if (bandLo > bandHi)
+                    std::swap(bandLo, bandHi);
+                double e = dy * (j - ay);
+                if (dx != 0) {
+                    double t0 = -e / dx, t1 = (len2 - e) / dx;
+                    if (t0 > t1)
+                        std::swap(t0, t1);
+                    bandLo = std::max(bandLo, ax + t0);
+                    bandHi = std::min(bandHi, ax + t1);
+                }
+                else if (e < 0 || e > len2)
+                    bandLo = INFINITY;
+                if (bandLo <= bandHi) {
+                    lo = std::min(lo, bandLo);
+                    hi = std::max(hi, bandHi);
+                }
+            }
+            else if (len2 > 0 && std::fabs(j - ay) <= r) {
+                // Horizontal
+                lo = std::min(lo, std::min(ax, bx));
+                hi = std::max(hi, std::max(ax, bx));
+            }
+
+            lo = std::max(lo, 0.0);
+            hi = std::min(hi, width - 1.0);
+            if (!(lo <= hi))
+                continue;
+            int i0 = int(std::ceil(lo));
+            int i1 = int(std::floor(hi));
+            if (i0 <= i1 && f(j * wordsPerRow, i0, i1))
+                return;
+        }
+    }
+};
+
+} // namespace cam
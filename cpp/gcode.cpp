@@ -0,0 +1,505 @@
+// Copyright 2014 Todd Fleming
+//
+// This file is part of jscut.
+//
+// jscut is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// jscut is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with jscut.  If not, see <http://www.gnu.org/licenses/>.
+
+#define _USE_MATH_DEFINES
+
+#include "gcode.h"
+#include "arena.h"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <unistd.h>
+
+using namespace cam;
+using namespace std;
+
+static const char digitPairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const unsigned long long pow10Table[] = {
+    1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull, 100000000ull, 1000000000ull,
+};
+
+// Write n's digits, right aligned, ending just before end. Writes at least minDigits
+// digits, padding with 0s. Returns the first digit.
+static char* writeDigitsBackward(char* end, unsigned long long n, int minDigits)
+{
+    char* p = end;
+    while (n >= 100) {
+        unsigned i = (n % 100) * 2;
+        n /= 100;
+        *--p = digitPairs[i + 1];
+        *--p = digitPairs[i];
+    }
+    if (n >= 10) {
+        *--p = digitPairs[n * 2 + 1];
+        *--p = digitPairs[n * 2];
+    }
+    else
+        *--p = '0' + n;
+    while (end - p < minDigits)
+        *--p = '0';
+    return p;
+}
+
+char* cam::formatFixed(char* p, double x, int decimal)
+{
+    decimal = max(0, min(decimal, 9));
+
+    // toFixed rounds the exact value of x, with ties going away from zero. The
+    // product's rounding error is exact (fma), so the true fraction is
+    // (product - floor(product)) + error; only its sign relative to 0.5 matters.
+    double scale = pow10Table[decimal];
+    double product = fabs(x) * scale;
+    double error = fma(fabs(x), scale, -product);
+    double integral = floor(product);
+    unsigned long long scaled = (unsigned long long)integral + ((product - integral - 0.5) + error >= 0);
+    unsigned long long integer = scaled / pow10Table[decimal];
+    unsigned long long fraction = scaled % pow10Table[decimal];
+
+    *p = '-';
+    p += x < 0;
+
+    char digits[32];
+    char* end = digits + sizeof(digits);
+    char* first = end;
+    if (decimal) {
+        first = writeDigitsBackward(end, fraction, decimal);
+        *--first = '.';
+    }
+    first = writeDigitsBackward(first, integer, 1);
+    size_t n = end - first;
+    memcpy(p, first, n);
+    return p + n;
+}
+
+GcodeBuffer::GcodeBuffer(int fd) :
+    fd(fd)
+{
+}
+
+GcodeBuffer::~GcodeBuffer()
+{
+    try {
+        flush();
+    }
+    catch (...) {
+    }
+    free(buffer);
+}
+
+char* GcodeBuffer::reserve(size_t n)
+{
+    if (fd >= 0 && used && used + n > flushSize)
+        flush();
+    if (used + n > capacity) {
+        size_t newCapacity = max(max(capacity * 2, used + n), flushSize * 2);
+        char* newBuffer = (char*)realloc(buffer, newCapacity);
+        if (!newBuffer)
+            throw bad_alloc();
+        buffer = newBuffer;
+        capacity = newCapacity;
+    }
+    return buffer + used;
+}
+
+void GcodeBuffer::append(const char* s, size_t n)
+{
+    memcpy(reserve(n), s, n);
+    used += n;
+}
+
+void GcodeBuffer::append(const char* s)
+{
+    append(s, strlen(s));
+}
+
+void GcodeBuffer::appendFixed(double x, int decimal)
+{
+    used = formatFixed(reserve(32), x, decimal) - buffer;
+}
+
+void GcodeBuffer::appendNumber(double x)
+{
+    if (x == 0) {
+        append("0", 1);
+        return;
+    }
+
+    // Shortest digits which read back as x
+    char s[32];
+    for (int precision = 1; precision <= 17; ++precision) {
+        snprintf(s, sizeof(s), "%.*e", precision - 1, x);
+        if (strtod(s, nullptr) == x)
+            break;
+    }
+
+    // Split "-d.ddde+xx" into sign, digits, and exponent
+    char digits[20];
+    int k = 0;
+    const char* q = s;
+    bool negative = *q == '-';
+    q += negative;
+    for (; *q != 'e'; ++q)
+        if (*q != '.')
+            digits[k++] = *q;
+    int n = atoi(q + 1) + 1; // x = 0.digits * 10^n
+
+    // Layout from ECMAScript's Number::toString
+    char result[40];
+    char* p = result;
+    if (negative)
+        *p++ = '-';
+    if (k <= n && n <= 21) {
+        p = copy(digits, digits + k, p);
+        p = fill_n(p, n - k, '0');
+    }
+    else if (0 < n && n <= 21) {
+        p = copy(digits, digits + n, p);
+        *p++ = '.';
+        p = copy(digits + n, digits + k, p);
+    }
+    else if (-6 < n && n <= 0) {
+        *p++ = '0';
+        *p++ = '.';
+        p = fill_n(p, -n, '0');
+        p = copy(digits, digits + k, p);
+    }
+    else {
+        *p++ = digits[0];
+        if (k > 1) {
+            *p++ = '.';
+            p = copy(digits + 1, digits + k, p);
+        }
+        p += sprintf(p, "e%c%d", n - 1 < 0 ? '-' : '+', abs(n - 1));
+    }
+    append(result, p - result);
+}
+
+void GcodeBuffer::flush()
+{
+    if (fd < 0)
+        return;
+    size_t pos = 0;
+    while (pos < used) {
+        ssize_t n = ::write(fd, buffer + pos, used - pos);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            throw runtime_error(string("gcode write failed: ") + strerror(errno));
+        }
+        pos += n;
+    }
+    used = 0;
+}
+
+char* GcodeBuffer::release()
+{
+    char* result = buffer;
+    buffer = nullptr;
+    used = 0;
+    capacity = 0;
+    return result;
+}
+
+namespace {
+    // Port of getGcode() in js/Cam.js; keep the two in sync
+    struct GcodeWriter {
+        GcodeBuffer& out;
+        const PolygonSet& tabGeometry;
+        const GcodeOptions& options;
+        double tabZ;
+        bool hasTabs;
+        bool tabError = false;
+        char rapidFeed[32];
+        char plungeFeed[32];
+        char cutFeed[32];
+
+        GcodeWriter(GcodeBuffer& out, const PolygonSet& tabGeometry, const GcodeOptions& options) :
+            out(out),
+            tabGeometry(tabGeometry),
+            options(options),
+            tabZ(options.tabZ),
+            hasTabs(!tabGeometry.empty() && options.tabZ > options.botZ)
+        {
+            if (!hasTabs)
+                tabZ = options.botZ;
+            formatFeed(rapidFeed, options.rapidFeed);
+            formatFeed(plungeFeed, options.plungeFeed);
+            formatFeed(cutFeed, options.cutFeed);
+        }
+
+        void formatFeed(char* dest, double feed)
+        {
+            GcodeBuffer b;
+            b.append(" F");
+            b.appendNumber(feed);
+            memcpy(dest, b.data(), b.size());
+            dest[b.size()] = 0;
+        }
+
+        double getX(const PointWithZ& p) const
+        {
+            return p.x * options.scale + options.offsetX;
+        }
+
+        double getY(const PointWithZ& p) const
+        {
+            return -p.y * options.scale + options.offsetY;
+        }
+
+        static double dist(double x1, double y1, double x2, double y2)
+        {
+            return sqrt((x2 - x1) * (x2 - x1) + (y2 - y1) * (y2 - y1));
+        }
+
+        double dist(const PointWithZ& a, const PointWithZ& b) const
+        {
+            return dist(getX(a), getY(a), getX(b), getY(b));
+        }
+
+        void fixed(double x)
+        {
+            out.appendFixed(x, options.decimal);
+        }
+
+        void point(const PointWithZ& p, bool useZ)
+        {
+            out.append(" X", 2);
+            fixed(getX(p));
+            out.append(" Y", 2);
+            fixed(getY(p));
+            if (useZ) {
+                out.append(" Z", 2);
+                fixed(p.z * options.scale + options.topZ);
+            }
+        }
+
+        void retract()
+        {
+            out.append("; Retract\r\nG1 Z");
+            fixed(options.safeZ);
+            out.append(rapidFeed);
+            out.append("\r\n");
+        }
+
+        void retractForTab()
+        {
+            out.append("; Retract for tab\r\nG1 Z");
+            fixed(tabZ);
+            out.append(rapidFeed);
+            out.append("\r\n");
+        }
+
+        // Ramp from currentZ down to selectedZ along the start of path. Returns false
+        // if path is too short.
+        bool ramp(const vector<PointWithZ>& path, double currentZ, double selectedZ)
+        {
+            double minPlungeTime = (currentZ - selectedZ) / options.plungeFeed;
+            double idealDist = options.cutFeed * minPlungeTime;
+            size_t end;
+            double totalDist = 0;
+            for (end = 1; end < path.size(); ++end) {
+                if (totalDist > idealDist)
+                    break;
+                totalDist += 2 * dist(path[end - 1], path[end]);
+            }
+            if (!(totalDist > 0))
+                return false;
+
+            out.append("; ramp\r\n");
+            vector<PointWithZ> rampPath(path.begin(), path.begin() + end);
+            rampPath.insert(rampPath.end(), path.rend() - (end - 1), path.rend());
+            double distTravelled = 0;
+            for (size_t i = 1; i < rampPath.size(); ++i) {
+                distTravelled += dist(rampPath[i - 1], rampPath[i]);
+                double newZ = currentZ + distTravelled / totalDist * (selectedZ - currentZ);
+                out.append("G1", 2);
+                point(rampPath[i], false);
+                out.append(" Z", 2);
+                fixed(newZ);
+                if (i == 1) {
+                    out.append(" F", 2);
+                    fixed(min(totalDist / minPlungeTime, options.cutFeed));
+                }
+                out.append("\r\n", 2);
+            }
+            return true;
+        }
+
+        void path(size_t pathIndex, const GcodePath& camPath)
+        {
+            auto& origPath = camPath.path;
+            if (origPath.empty())
+                return;
+
+            vector<vector<PointWithZ>> separatedPaths;
+            if (hasTabs) {
+                Polygon poly;
+                poly.reserve(origPath.size());
+                for (auto& p: origPath)
+                    poly.push_back(p.toPoint());
+                bool error = false;
+                for (auto& piece: separateTabPaths(PolygonSet{move(poly)}, tabGeometry, error))
+                    separatedPaths.emplace_back(piece.begin(), piece.end());
+                tabError = tabError || error;
+            }
+            else
+                separatedPaths.push_back(origPath);
+
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%zu", pathIndex);
+            out.append("\r\n; Path ");
+            out.append(buf);
+            out.append("\r\n");
+
+            double currentZ = options.safeZ;
+            double finishedZ = options.topZ;
+            while (finishedZ > options.botZ) {
+                double nextZ = max(finishedZ - options.passDepth, options.botZ);
+                if (currentZ < options.safeZ && (!camPath.safeToClose || hasTabs)) {
+                    retract();
+                    currentZ = options.safeZ;
+                }
+
+                if (!hasTabs)
+                    currentZ = finishedZ;
+                else
+                    currentZ = max(finishedZ, tabZ);
+                out.append("; Rapid to initial position\r\nG1");
+                point(origPath[0], false);
+                out.append(rapidFeed);
+                out.append("\r\nG1 Z");
+                fixed(currentZ);
+                out.append("\r\n");
+
+                bool useOrig = nextZ >= tabZ || options.useZ;
+                size_t numSelected = useOrig ? 1 : separatedPaths.size();
+                for (size_t selectedIndex = 0; selectedIndex < numSelected; ++selectedIndex) {
+                    auto& selectedPath = useOrig ? origPath : separatedPaths[selectedIndex];
+                    if (selectedPath.empty())
+                        continue;
+
+                    if (!options.useZ) {
+                        double selectedZ = (selectedIndex & 1) ? tabZ : nextZ;
+                        if (selectedZ < currentZ) {
+                            if (!options.ramp || !ramp(selectedPath, currentZ, selectedZ)) {
+                                out.append("; plunge\r\nG1 Z");
+                                fixed(selectedZ);
+                                out.append(plungeFeed);
+                                out.append("\r\n");
+                            }
+                        }
+                        else if (selectedZ > currentZ)
+                            retractForTab();
+                        currentZ = selectedZ;
+                    }
+
+                    out.append("; cut\r\n");
+                    for (size_t i = 1; i < selectedPath.size(); ++i) {
+                        out.append("G1", 2);
+                        point(selectedPath[i], options.useZ);
+                        if (i == 1)
+                            out.append(cutFeed);
+                        out.append("\r\n", 2);
+                    }
+                }
+                finishedZ = nextZ;
+                if (options.useZ)
+                    break;
+            }
+            retract();
+        }
+    };
+}
+
+void cam::writeGcode(GcodeBuffer& out, const std::vector<GcodePath>& paths, const PolygonSet& tabGeometry, const GcodeOptions& options, bool& tabError)
+{
+    CAM_PROFILE_ZONE("writeGcode");
+    FlexScan::ArenaScope arena;
+    GcodeWriter writer(out, tabGeometry, options);
+    for (size_t i = 0; i < paths.size(); ++i)
+        writer.path(i, paths[i]);
+    tabError = writer.tabError;
+    CAM_PROFILE_COUNT("writeGcode.bytes", out.size());
+}
+
+extern "C" void getGcode(
+    const int* paths, const int* safeToClose, const int* tabGeometry,
+    const double* options,
+    int& tabError,
+    char*& result, int& resultSize)
+{
+    tabError = false;
+    result = nullptr;
+    resultSize = 0;
+    try {
+        FlatPaths flat{paths};
+        vector<GcodePath> gcodePaths(flat.numPaths());
+        for (int i = 0; i < flat.numPaths(); ++i) {
+            auto& path = gcodePaths[i].path;
+            path.reserve(flat.offsets()[i + 1] - flat.offsets()[i]);
+            for (int j = flat.offsets()[i]; j < flat.offsets()[i + 1]; ++j)
+                path.emplace_back(flat.coords()[j * 2], flat.coords()[j * 2 + 1], flat.hasZ() ? flat.z()[j] : 0);
+            gcodePaths[i].safeToClose = safeToClose[i] != 0;
+        }
+
+        GcodeOptions o;
+        o.ramp = options[gcodeRamp] != 0;
+        o.scale = options[gcodeScale];
+        o.useZ = options[gcodeUseZ] != 0;
+        o.offsetX = options[gcodeOffsetX];
+        o.offsetY = options[gcodeOffsetY];
+        o.decimal = lround(options[gcodeDecimal]);
+        o.topZ = options[gcodeTopZ];
+        o.botZ = options[gcodeBotZ];
+        o.safeZ = options[gcodeSafeZ];
+        o.passDepth = options[gcodePassDepth];
+        o.plungeFeed = options[gcodePlungeFeed];
+        o.retractFeed = options[gcodeRetractFeed];
+        o.cutFeed = options[gcodeCutFeed];
+        o.rapidFeed = options[gcodeRapidFeed];
+        o.tabZ = options[gcodeTabZ];
+
+        GcodeBuffer out;
+        bool writeTabError = false;
+        writeGcode(out, gcodePaths, convertPathsFromFlat(tabGeometry), o, writeTabError);
+        tabError = writeTabError;
+        resultSize = out.size();
+        result = out.release();
+    }
+    catch (exception& e) {
+        printf("%s\n", e.what());
+    }
+    catch (...) {
+        printf("???? unknown exception\n");
+    }
+};
@@ -0,0 +1,95 @@
+// Copyright 2014 Todd Fleming
+//
+// This file is part of jscut.
+//
+// jscut is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// jscut is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with jscut.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "cam.h"
+#include <cstddef>
+
+namespace cam {
+    // Settings for writeGcode(). These match getGcode()'s namedArgs in js/Cam.js.
+    struct GcodeOptions {
+        bool ramp = false;          // Ramp these paths?
+        double scale = 1;           // Factor to convert Clipper units to gcode units
+        bool useZ = false;          // Use Z coordinates in paths?
+        double offsetX = 0;         // Offset X (gcode units)
+        double offsetY = 0;         // Offset Y (gcode units)
+        int decimal = 4;            // Number of decimal places to keep in gcode (0-9)
+        double topZ = 0;            // Top of area to cut (gcode units)
+        double botZ = 0;            // Bottom of area to cut (gcode units)
+        double safeZ = 0;           // Z position to safely move over uncut areas (gcode units)
+        double passDepth = 0;       // Cut depth for each pass (gcode units)
+        double plungeFeed = 0;      // Feedrate to plunge cutter (gcode units)
+        double retractFeed = 0;     // Feedrate to retract cutter (gcode units)
+        double cutFeed = 0;         // Feedrate for horizontal cuts (gcode units)
+        double rapidFeed = 0;       // Feedrate for rapid moves (gcode units)
+        double tabZ = 0;            // Z position over tabs (gcode units)
+    };
+
+    // A toolpath (CamPath in js/Cam.js)
+    struct GcodePath {
+        std::vector<PointWithZ> path;
+        bool safeToClose = false;
+    };
+
+    // Growable byte buffer for gcode. Given a file descriptor, it writes through to it
+    // whenever it holds more than flushSize bytes.
+    class GcodeBuffer {
+    public:
+        static const size_t flushSize = 1 << 16;
+
+        explicit GcodeBuffer(int fd = -1);
+        GcodeBuffer(const GcodeBuffer&) = delete;
+        GcodeBuffer& operator=(const GcodeBuffer&) = delete;
+        ~GcodeBuffer();
+
+        void append(const char* s, size_t n);
+        void append(const char* s);
+
+        // Append x with decimal places (see formatFixed)
+        void appendFixed(double x, int decimal);
+
+        // Append x the way javascript converts numbers to strings
+        void appendNumber(double x);
+
+        // Write buffered bytes to the file descriptor, if there is one. Throws on errors.
+        void flush();
+
+        const char* data() const { return buffer; }
+        size_t size() const { return used; }
+
+        // Take the buffer; free it with free(). Leaves this empty.
+        char* release();
+
+    private:
+        int fd;
+        char* buffer = nullptr;
+        size_t used = 0;
+        size_t capacity = 0;
+
+        char* reserve(size_t n);
+    };
+
+    // Write x with decimal places (0-9) to p like javascript's toFixed; returns the end.
+    // p needs room for 32 chars. |x| must be below 2^52 / 10^decimal.
+    char* formatFixed(char* p, double x, int decimal);
+
+    // Append gcode for paths to out. Same output as getGcode() in js/Cam.js. Assumes the
+    // current Z position is at safeZ; the gcode returns Z to it at the end. Sets tabError
+    // if separateTabPaths() failed on any path; those paths are cut without tabs.
+    void writeGcode(GcodeBuffer& out, const std::vector<GcodePath>& paths, const PolygonSet& tabGeometry, const GcodeOptions& options, bool& tabError);
+}
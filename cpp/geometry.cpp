@@ -0,0 +1,124 @@
+// Copyright 2014 Todd Fleming
+//
+// This file is part of jscut.
+//
+// jscut is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// jscut is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with jscut.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "geometry.h"
+#include "offset.h"
+
+using namespace cam;
+using namespace FlexScan;
+using namespace std;
+
+// Live geometry by handle. Handles aren't reused, so a stale one finds nothing.
+static map<int, unique_ptr<Geometry>> geometries;
+static int nextHandle = 1;
+
+Geometry::Geometry(PolygonSet paths) :
+    polygons(move(paths))
+{
+}
+
+void Geometry::setPaths(PolygonSet paths)
+{
+    polygons = move(paths);
+    offsets.clear();
+    medialAxisCache.reset();
+    edgesCache.reset();
+}
+
+const PolygonSet& Geometry::offset(int amount)
+{
+    auto it = offsets.find(amount);
+    if (it != offsets.end()) {
+        it->second.lastUse = ++offsetUses;
+        return it->second.polygons;
+    }
+
+    PolygonSet result;
+    {
+        ArenaScope arena;
+        result = FlexScan::offset(polygons, amount, arcTolerance, true);
+    }
+    if (offsets.size() >= maxOffsets) {
+        auto leastRecent = min_element(offsets.begin(), offsets.end(), [](const pair<const int, CachedOffset>& a, const pair<const int, CachedOffset>& b) {
+            return a.second.lastUse < b.second.lastUse;
+        });
+        offsets.erase(leastRecent);
+    }
+    auto& entry = offsets[amount];
+    entry.polygons = move(result);
+    entry.lastUse = ++offsetUses;
+    return entry.polygons;
+}
+
+const MedialAxis& Geometry::medialAxis()
+{
+    if (!medialAxisCache) {
+        ArenaScope arena;
+        unique_ptr<MedialAxis> medialAxis(new MedialAxis);
+        buildMedialAxis(polygons, *medialAxis);
+        medialAxisCache = move(medialAxis);
+    }
+    return *medialAxisCache;
+}
+
+const EdgeBvh<Point>& Geometry::edges()
+{
+    if (!edgesCache)
+        edgesCache.reset(new EdgeBvh<Point>(polygons));
+    return *edgesCache;
+}
+
+Geometry* cam::findGeometry(int handle)
+{
+    auto it = geometries.find(handle);
+    return it == geometries.end() ? nullptr : it->second.get();
+}
+
+extern "C" int createGeometry(const int* paths)
+{
+    try {
+        int handle = nextHandle++;
+        geometries[handle].reset(new Geometry(convertPathsFromFlat(paths)));
+        return handle;
+    }
+    catch (exception& e) {
+        printf("%s\n", e.what());
+    }
+    catch (...) {
+        printf("???? unknown exception\n");
+    }
+    return 0;
+};
+
+extern "C" void setGeometry(int geometry, const int* paths)
+{
+    try {
+        if (Geometry* g = findGeometry(geometry))
+            g->setPaths(convertPathsFromFlat(paths));
+    }
+    catch (exception& e) {
+        printf("%s\n", e.what());
+    }
+    catch (...) {
+        printf("???? unknown exception\n");
+    }
+};
+
+extern "C" void destroyGeometry(int geometry)
+{
+    geometries.erase(geometry);
+};
@@ -0,0 +1,117 @@
+// Copyright 2014 Todd Fleming
+//
+// This file is part of jscut.
+//
+// jscut is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// jscut is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with jscut.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "cam.h"
+#include "FlexScan.h"
+#include <boost/polygon/voronoi.hpp>
+#include <map>
+#include <memory>
+
+namespace cam {
+    // Voronoi diagram of one group of closed polygons' segments, and which of its edges lie
+    // inside the polygons
+    struct MedialAxisPart {
+        std::vector<Segment> segments;
+        boost::polygon::voronoi_diagram<double> diagram;
+
+        // Indexes into diagram.edges() of the primary finite edges inside the geometry, in
+        // diagram order. Each twin pair appears once.
+        std::vector<size_t> insideEdges;
+
+        // Whether each of diagram.edges() is inside the geometry, primary or secondary.
+        // Twins match. A secondary edge through a vertex whose segments are collinear is
+        // partly inside, and counts.
+        std::vector<bool> edgeInside;
+
+        // Whether the inside is on the left of segments
+        bool insideIsLeft = true;
+    };
+
+    // Medial axis of closed polygons. Doesn't depend on any cutter setting.
+    //
+    // Polygons whose bounding boxes overlap, directly or through a chain of others, form a
+    // group; nothing nests inside a polygon without overlapping its box. A point inside a
+    // group is closer to that group's boundary than to anything outside it, so each group's
+    // diagram is built on its own. Parts are in order of each group's first polygon.
+    struct MedialAxis {
+        std::vector<MedialAxisPart> parts;
+    };
+
+    // Fill result (a new MedialAxis) for geometry. Filled in place: the diagram's cells and
+    // edges point at each other, so it can't be copied. A parallel policy builds the parts
+    // on worker threads; the result doesn't depend on it.
+    void buildMedialAxis(
+        const PolygonSet& geometry, MedialAxis& result,
+        const FlexScan::ExecutionPolicy& policy = FlexScan::defaultExecutionPolicy());
+
+    // The geometry medialAxis was built from, inset by amount (> 0): the boundary of the
+    // points at least amount from its boundary, outer polygons counterclockwise and holes
+    // clockwise as offset() leaves them. Each polygon is traced cell by cell through the
+    // diagram, a straight piece across a segment's cell and an arc across a vertex's, so it
+    // never crosses itself and needs no cleaning. Any number of amounts come from one
+    // diagram. A parallel policy traces the parts on worker threads; the result doesn't
+    // depend on it.
+    PolygonSet medialAxisInset(
+        const MedialAxis& medialAxis, double amount, double arcTolerance,
+        const FlexScan::ExecutionPolicy& policy = FlexScan::defaultExecutionPolicy());
+
+    // Geometry kept across calls through a handle (createGeometry()). Data derived from the
+    // paths is built the first time something asks for it and kept until the paths change.
+    class Geometry {
+    public:
+        explicit Geometry(PolygonSet paths);
+        Geometry(const Geometry&) = delete;
+        Geometry& operator=(const Geometry&) = delete;
+
+        const PolygonSet& paths() const { return polygons; }
+
+        // Replace the paths; drops everything derived from the old ones
+        void setPaths(PolygonSet paths);
+
+        // offset(paths(), amount, arcTolerance, true). Keeps the maxOffsets most recently
+        // used amounts; the result stays valid until maxOffsets other amounts have been
+        // asked for since, or the paths change.
+        const PolygonSet& offset(int amount);
+
+        const MedialAxis& medialAxis();
+
+        // Index over the paths' edges (closed)
+        const FlexScan::EdgeBvh<Point>& edges();
+
+    private:
+        static const size_t maxOffsets = 8;
+
+        struct CachedOffset {
+            PolygonSet polygons;
+            unsigned long long lastUse;
+        };
+
+        PolygonSet polygons;
+        std::map<int, CachedOffset> offsets;
+        unsigned long long offsetUses = 0;
+        std::unique_ptr<MedialAxis> medialAxisCache;
+        std::unique_ptr<FlexScan::EdgeBvh<Point>> edgesCache;
+    };
+
+    // Geometry for a handle from createGeometry(), or nullptr if there isn't one
+    Geometry* findGeometry(int handle);
+
+    // separateTabPaths() against cached tab geometry
+    PolygonSet separateTabPaths(const PolygonSet& paths, Geometry& tabs, bool& error);
+}
@@ -18,7 +18,11 @@
 #define _USE_MATH_DEFINES
 
 #include "cam.h"
+#include "cutRaster.h"
+#include "geometry.h"
 #include "offset.h"
+#include <boost/polygon/voronoi.hpp>
+#include <memory>
 
 using namespace cam;
 using namespace FlexScan;
@@ -27,331 +31,661 @@ using namespace std;
 
 static const long long spiralArcTolerance = inchToClipperScale / 1000;
 
+// Edge of a boundary loop being clipped, or of the region it's clipped against (isGeometry)
 template<typename Derived>
-struct SpiralEdge {
+struct FrontEdge {
     bool isGeometry = false;
-    size_t index;
+    bool inside = false;
+    int path = 0;
+    int index = 0;
 };
 
-//struct CandidatePath {
-//    Path path;
-//    double distToCurrentPos;
-//};
-
 Polygon createSpiral(int stepover, int startX, int startY, double spiralR) {
+    CAM_PROFILE_ZONE("createSpiral");
     Polygon spiral;
-    auto spiralStartTime = std::chrono::high_resolution_clock::now();
     double angle = 0;
     while (true) {
         double r = angle / M_PI / 2 * stepover;
-        spiral.push_back({lround(r * cos(-angle) + startX), lround(r * sin(-angle) + startY)});
+        spiral.push_back({int(lround(r * cos(-angle) + startX)), int(lround(r * sin(-angle) + startY))});
         double deltaAngle = deltaAngleForError(spiralArcTolerance, max(r, (double)spiralArcTolerance));
         angle += deltaAngle;
         if (r >= spiralR)
             break;
     }
-    printf("spiral: %d\n", (int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - spiralStartTime).count());
+    CAM_PROFILE_COUNT("createSpiral.vertices", spiral.size());
     return spiral;
 }
 
-void trimSpiral(Polygon& spiral, const PolygonSet& safeArea) {
-    auto spiralTrimStartTime = std::chrono::high_resolution_clock::now();
+// Cut the spiral off before the first segment which touches safeArea's boundary. Walks
+// outward from the center, so the work is proportional to the part which is kept.
+void trimSpiral(Polygon& spiral, const EdgeBvh<Point>& safeArea) {
+    CAM_PROFILE_ZONE("trimSpiral");
+    size_t endIndex = 0;
+    if (!spiral.empty() && safeArea.contains(spiral[0])) {
+        endIndex = 1;
+        while (endIndex < spiral.size() && !safeArea.intersects(spiral[endIndex - 1], spiral[endIndex]))
+            ++endIndex;
+    }
+    CAM_PROFILE_COUNT("trimSpiral.removed", spiral.size() - endIndex);
+    spiral.erase(spiral.begin() + endIndex, spiral.end());
+}
+
+// Pieces of the boundary loops which lie outside region, as open paths in the loops'
+// direction. A loop which is entirely outside comes back closed (last point == first).
+PolygonSet clipLoops(const PolygonSet& loops, const PolygonSet& region) {
+    CAM_PROFILE_ZONE("clipLoops");
 
-    using Edge = Edge<Point, SpiralEdge>;
+    using Edge = Edge<Point, FrontEdge>;
     using ScanlineEdge = ScanlineEdge<Edge, ScanlineEdgeWindingNumber>;
     using Scan = Scan<ScanlineEdge>;
 
-    vector<Edge> edges;
-    Scan::insertPolygons(edges, safeArea.begin(), safeArea.end(), true);
+    ArenaVector<Edge> edges;
+    Scan::insertPolygons(edges, region.begin(), region.end());
     for (auto& edge: edges)
         edge.isGeometry = true;
-    auto spiralBegin = edges.size();
-    Scan::insertPoints(edges, spiral, false, true);
-    for (size_t i = 0; i < spiral.size(); ++i)
-        edges[spiralBegin + i].index = i;
+    for (size_t i = 0; i < loops.size(); ++i) {
+        auto loopBegin = edges.size();
+        Scan::insertPoints(edges, loops[i], true, true);
+        for (size_t j = loopBegin; j < edges.size(); ++j) {
+            edges[j].path = i;
+            edges[j].index = j - loopBegin;
+        }
+    }
 
     Scan::intersectEdges(edges, edges.begin(), edges.end());
     Scan::sortEdges(edges.begin(), edges.end());
-
-    size_t endIndex = spiral.size();
     Scan::scan(
         edges.begin(), edges.end(),
         makeAccumulateWindingNumber([](ScanlineEdge& e){return e.edge->isGeometry; }),
-        [&endIndex](int x, double y, vector<ScanlineEdge>::iterator begin, vector<ScanlineEdge>::iterator end)
+        [](int x, double y, ArenaVector<ScanlineEdge>::iterator begin, ArenaVector<ScanlineEdge>::iterator end)
     {
-        while (begin != end) {
-            bool isInGeometry = begin->windingNumberBefore && begin->windingNumberAfter;
-            if (!begin->edge->isGeometry && !isInGeometry && begin->edge->index < endIndex)
-                endIndex = begin->edge->index;
-            ++begin;
+        for (; begin != end; ++begin)
+            if (!begin->edge->isGeometry)
+                begin->edge->inside = begin->windingNumberBefore && begin->windingNumberAfter;
+    });
+
+    // Put the split pieces back in loop order. Pieces of one original edge are ordered by
+    // how far their start is from the edge's start.
+    struct Piece {
+        int path;
+        int index;
+        long long distance;
+        Point start;
+        Point end;
+        bool inside;
+    };
+    ArenaVector<Piece> pieces;
+    for (auto& edge: edges) {
+        if (edge.isGeometry)
+            continue;
+        Point start = swapped(edge) ? edge.point2 : edge.point1;
+        Point end = swapped(edge) ? edge.point1 : edge.point2;
+        auto& origin = loops[edge.path][edge.index];
+        long long dx = x(start) - x(origin);
+        long long dy = y(start) - y(origin);
+        pieces.push_back({edge.path, edge.index, dx * dx + dy * dy, start, end, edge.inside});
+    }
+    sort(pieces.begin(), pieces.end(), [](const Piece& a, const Piece& b) {
+        return a.path < b.path || a.path == b.path && (a.index < b.index || a.index == b.index && a.distance < b.distance);
+    });
+
+    PolygonSet result;
+    for (auto loopBegin = pieces.begin(); loopBegin != pieces.end();) {
+        auto loopEnd = loopBegin;
+        while (loopEnd != pieces.end() && loopEnd->path == loopBegin->path)
+            ++loopEnd;
+
+        size_t loopResultBegin = result.size();
+        bool inRun = false;
+        bool anyInside = false;
+        for (auto it = loopBegin; it != loopEnd; ++it) {
+            if (it->inside) {
+                inRun = false;
+                anyInside = true;
+                continue;
+            }
+            if (!inRun) {
+                result.push_back({it->start});
+                inRun = true;
+            }
+            result.back().push_back(it->end);
+        }
+
+        // A run which reaches the loop's end continues into the run at its start
+        if (anyInside && !loopBegin->inside && !(loopEnd - 1)->inside && result.size() - loopResultBegin > 1) {
+            auto& last = result.back();
+            auto& first = result[loopResultBegin];
+            last.insert(last.end(), first.begin() + 1, first.end());
+            first = move(last);
+            result.pop_back();
+        }
+
+        loopBegin = loopEnd;
+    }
+
+    for (auto& path: result)
+        if (path.size() < 2)
+            path.clear();
+    result.erase(remove_if(result.begin(), result.end(), [](const Polygon& p){return p.empty(); }), result.end());
+    CAM_PROFILE_COUNT("clipLoops.paths", result.size());
+    return result;
+}
+
+static double squaredDist(const Point& a, const Point& b) {
+    double dx = (double)x(a) - x(b);
+    double dy = (double)y(a) - y(b);
+    return dx * dx + dy * dy;
+}
+
+// Squared distance from (px, py) to segment ab
+static double squaredDistToSegment(double px, double py, const Point& a, const Point& b) {
+    double dx = (double)x(b) - x(a);
+    double dy = (double)y(b) - y(a);
+    double len2 = dx * dx + dy * dy;
+    double t = len2 ? ((px - x(a)) * dx + (py - y(a)) * dy) / len2 : 0;
+    t = max(0.0, min(1.0, t));
+    double ex = x(a) + t * dx - px;
+    double ey = y(a) + t * dy - py;
+    return ex * ex + ey * ey;
+}
+
+// Squared distance from p to segment ab
+static double squaredDistToSegment(const Point& p, const Point& a, const Point& b) {
+    return squaredDistToSegment(x(p), y(p), a, b);
+}
+
+// Drop vertices within tolerance of the line joining their neighbors. Offsetting adds
+// vertices at every convex corner, so repeated offsets of curves would otherwise double
+// their vertex count each time. Open paths keep their ends.
+void simplify(PolygonSet& ps, double tolerance, bool closed) {
+    CAM_PROFILE_ZONE("simplify");
+    double tolerance2 = tolerance * tolerance;
+    for (auto& poly: ps) {
+        if (poly.size() < 3)
+            continue;
+        Polygon result;
+        result.reserve(poly.size());
+        result.push_back(poly[0]);
+        for (size_t i = 1; i + 1 < poly.size(); ++i)
+            if (squaredDistToSegment(poly[i], result.back(), poly[i + 1]) > tolerance2)
+                result.push_back(poly[i]);
+        result.push_back(poly.back());
+        if (closed && result.size() >= 3 && squaredDistToSegment(result.back(), result[result.size() - 2], result[0]) <= tolerance2)
+            result.pop_back();
+        poly = move(result);
+    }
+    if (closed)
+        ps.erase(remove_if(ps.begin(), ps.end(), [](const Polygon& p){return p.size() < 3; }), ps.end());
+}
+
+// Order paths so each starts close to where the previous one ended. Open paths are cut
+// from their last point back to their first, as the Clipper version did; closed paths
+// start at their vertex nearest the current position.
+PolygonSet orderPaths(PolygonSet paths, Point& currentPos) {
+    CAM_PROFILE_ZONE("orderPaths");
+    PolygonSet result;
+    result.reserve(paths.size());
+    while (!paths.empty()) {
+        size_t bestPath = 0;
+        size_t bestVertex = 0;
+        double bestDist = numeric_limits<double>::max();
+        for (size_t i = 0; i < paths.size(); ++i) {
+            auto& path = paths[i];
+            if (path.front() == path.back()) {
+                for (size_t j = 0; j + 1 < path.size(); ++j) {
+                    double d = squaredDist(path[j], currentPos);
+                    if (d < bestDist) {
+                        bestDist = d;
+                        bestPath = i;
+                        bestVertex = j;
+                    }
+                }
+            }
+            else {
+                double d = squaredDist(path.back(), currentPos);
+                if (d < bestDist) {
+                    bestDist = d;
+                    bestPath = i;
+                    bestVertex = path.size() - 1;
+                }
+            }
         }
+
+        Polygon path = move(paths[bestPath]);
+        paths[bestPath] = move(paths.back());
+        paths.pop_back();
+        if (path.front() == path.back()) {
+            path.pop_back();
+            rotate(path.begin(), path.begin() + bestVertex, path.end());
+            path.push_back(path.front());
+        }
+        reverse(path.begin(), path.end());
+        currentPos = path.back();
+        result.push_back(move(path));
+    }
+    return result;
+}
+
+// Trim path to the segments which cut new material; empty if none do. Queries use a
+// radius a little under the cutter's so that retracing an edge of the cut area doesn't
+// count as new.
+void trimToNewMaterial(Polygon& path, const CutRaster& raster, double radius) {
+    double queryRadius = radius - raster.cellSize() / 2;
+    size_t first = 0;
+    while (first + 1 < path.size() && !raster.segmentCutsNew(path[first], path[first + 1], queryRadius))
+        ++first;
+    if (first + 1 >= path.size()) {
+        path.clear();
+        return;
+    }
+    size_t last = path.size() - 1;
+    while (last > first + 1 && !raster.segmentCutsNew(path[last - 1], path[last], queryRadius))
+        --last;
+    path.erase(path.begin() + last + 1, path.end());
+    path.erase(path.begin(), path.begin() + first);
+}
+
+static double signedArea(const Polygon& poly) {
+    double area = 0;
+    for (size_t i = 0; i < poly.size(); ++i) {
+        auto& a = poly[i];
+        auto& b = poly[i + 1 < poly.size() ? i + 1 : 0];
+        area += (double)x(a) * y(b) - (double)x(b) * y(a);
+    }
+    return area / 2;
+}
+
+// Is p inside poly? Points on the boundary may go either way.
+static bool containsPoint(const Polygon& poly, const Point& p) {
+    bool inside = false;
+    for (size_t i = 0, j = poly.size() - 1; i < poly.size(); j = i++) {
+        auto& a = poly[i];
+        auto& b = poly[j];
+        if ((y(a) > y(p)) != (y(b) > y(p)) &&
+            x(p) < x(a) + ((double)x(b) - x(a)) * ((double)y(p) - y(a)) / ((double)y(b) - y(a)))
+            inside = !inside;
+    }
+    return inside;
+}
+
+// Split ps into connected regions: each outer boundary followed by its holes. A hole
+// belongs to the smallest outer boundary which contains it.
+vector<PolygonSet> splitComponents(const PolygonSet& ps) {
+    CAM_PROFILE_ZONE("splitComponents");
+    vector<double> areas;
+    double outerSign = 0;
+    for (auto& poly: ps) {
+        areas.push_back(signedArea(poly));
+        if (fabs(areas.back()) > fabs(outerSign))
+            outerSign = areas.back();
+    }
+
+    struct Outer {
+        size_t poly;
+        Point low;
+        Point high;
+    };
+    vector<Outer> outers;
+    vector<PolygonSet> result;
+    for (size_t i = 0; i < ps.size(); ++i) {
+        if (ps[i].empty() || areas[i] * outerSign <= 0)
+            continue;
+        Point low = ps[i][0], high = ps[i][0];
+        for (auto& p: ps[i]) {
+            low = {min(x(low), x(p)), min(y(low), y(p))};
+            high = {max(x(high), x(p)), max(y(high), y(p))};
+        }
+        outers.push_back({i, low, high});
+        result.push_back({ps[i]});
+    }
+
+    for (size_t i = 0; i < ps.size(); ++i) {
+        if (ps[i].empty() || areas[i] * outerSign > 0)
+            continue;
+        auto& p = ps[i][0];
+        size_t best = outers.size();
+        for (size_t j = 0; j < outers.size(); ++j) {
+            auto& outer = outers[j];
+            if (x(p) < x(outer.low) || x(p) > x(outer.high) || y(p) < y(outer.low) || y(p) > y(outer.high))
+                continue;
+            if ((best == outers.size() || fabs(areas[outer.poly]) < fabs(areas[outers[best].poly])) && containsPoint(ps[outer.poly], p))
+                best = j;
+        }
+        if (best < outers.size())
+            result[best].push_back(ps[i]);
+    }
+    return result;
+}
+
+// Is p inside the region (outer boundary first, then holes)?
+static bool componentContains(const PolygonSet& component, const Point& p) {
+    if (component.empty() || !containsPoint(component[0], p))
+        return false;
+    for (size_t i = 1; i < component.size(); ++i)
+        if (containsPoint(component[i], p))
+            return false;
+    return true;
+}
+
+// Center and radius of the largest circle inside ps. The center of the largest inscribed
+// circle is a vertex of the medial axis. Returns false if ps has no inside Voronoi vertices.
+//
+// The clearing loop leaves slivers, and buildMedialAxis can class vertices near them as
+// inside when they aren't. Vertices are tried from the largest clearance down, each
+// checked against ps's edges; a vertex's distance to the boundary is at most its clearance
+// (its distance to one site), so the search stops once no clearance left beats the best.
+bool largestInscribedCircle(const PolygonSet& ps, Point& center, double& radius) {
+    CAM_PROFILE_ZONE("largestInscribedCircle");
+
+    // buildMedialAxis takes the inside's side from the lowest polygon; a zero-area one
+    // would turn its group inside out
+    PolygonSet regions;
+    for (auto& poly: ps)
+        if (signedArea(poly) != 0)
+            regions.push_back(poly);
+    MedialAxis medialAxis;
+    buildMedialAxis(regions, medialAxis);
+
+    // A vertex's clearance is its distance to the site of any cell it bounds
+    vector<pair<double, Point>> candidates;
+    for (auto& part: medialAxis.parts) {
+        for (auto i: part.insideEdges) {
+            auto& edge = part.diagram.edges()[i];
+            auto cell = edge.cell();
+            auto& segment = part.segments[cell->source_index()];
+            for (auto vertex: {edge.vertex0(), edge.vertex1()}) {
+                double clearance2;
+                if (cell->contains_point()) {
+                    Point site = cell->source_category() == bp::SOURCE_CATEGORY_SEGMENT_START_POINT ? low(segment) : high(segment);
+                    double dx = vertex->x() - x(site);
+                    double dy = vertex->y() - y(site);
+                    clearance2 = dx * dx + dy * dy;
+                }
+                else
+                    clearance2 = squaredDistToSegment(vertex->x(), vertex->y(), low(segment), high(segment));
+                candidates.emplace_back(clearance2, Point(int(lround(vertex->x())), int(lround(vertex->y()))));
+            }
+        }
+    }
+    sort(candidates.begin(), candidates.end(), [](const pair<double, Point>& a, const pair<double, Point>& b) {
+        return a.first > b.first;
     });
 
-    spiral.erase(spiral.begin() + endIndex, spiral.end());
+    EdgeBvh<Point> edges(regions);
+    double bestDist2 = -1;
+    for (auto& candidate: candidates) {
+        if (candidate.first <= bestDist2)
+            break;
+        if (!edges.contains(candidate.second))
+            continue;
+        double dist2;
+        edges.nearest(candidate.second, dist2);
+        if (dist2 > bestDist2) {
+            bestDist2 = dist2;
+            center = candidate.second;
+        }
+    }
 
-    printf("spiral trim time: %d\n", (int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - spiralTrimStartTime).count());
+    if (bestDist2 < 0)
+        return false;
+    radius = sqrt(bestDist2);
+    return true;
+}
+
+// hspocket settings in clipper units. See enum HspocketOption.
+struct HspocketSettings {
+    bool hasStart = false;
+    Point start;
+    int stepover;
+    int minRadius;
+    int minProgress;
+    double rasterCellSize;
+    int precision = int(lround(inchToClipperScale / 5000));
+
+    HspocketSettings(double cutterDia, const double* options) {
+        auto option = [options](HspocketOption i) {
+            return options ? options[i] : NAN;
+        };
+        if (!isnan(option(hspocketStartX)) && !isnan(option(hspocketStartY))) {
+            hasStart = true;
+            start = Point(int(lround(option(hspocketStartX))), int(lround(option(hspocketStartY))));
+        }
+        double s = option(hspocketStepover);
+        stepover = max(1, int(lround(isnan(s) ? cutterDia / 4 : min(s, cutterDia))));
+        double r = option(hspocketMinRadius);
+        minRadius = max(0, int(lround(isnan(r) ? cutterDia / 8 : r)));
+        double p = option(hspocketMinProgress);
+        minProgress = max(1, int(lround(isnan(p) ? stepover / 8.0 : min(p, (double)stepover))));
+        double c = option(hspocketRasterCellSize);
+        rasterCellSize = isnan(c) ? minProgress / 2.0 : max(0.0, c);
+    }
+};
+
+// Clear one connected region of the safe area. Each entry starts with a spiral in the
+// largest circle which fits in the region's uncut part (or at start, for the first), so
+// parts the clearing loop can't reach get their own entry. Each entry clears at least a
+// circle of radius min(stepover, minRadius), so the entries end once no circle that size
+// fits in what is left.
+//
+// Each layer follows the boundary of the front, skipping the parts which are within
+// minProgress of a cut path (the back). The front is the area within stepover of every
+// path cut so far, kept to where the cutter's center can go; the back is the area within
+// minProgress of them, plus the front as it was before the last layer. Every point of a
+// layer's paths is between minProgress and stepover beyond the previous cut, so engagement
+// is bounded by construction.
+//
+// Both grow by the offsets of each layer's own paths. Offsets never see the history; each
+// layer only merges its bands into the front and back, and clipLoops scans the two.
+//
+// A raster copy of the cut area (CutRaster) trims each path to the part which cuts new
+// material, which catches pieces of one layer that overlap each other.
+static void clearComponent(
+    const PolygonSet& safeArea, double cutterDia, const HspocketSettings& settings,
+    const Point* start, Point& currentPos, PathSink& sink)
+{
+    CAM_PROFILE_ZONE("clearComponent");
+    double r = cutterDia / 2;
+    auto precision = settings.precision;
+    auto stepover = settings.stepover;
+    auto minProgress = settings.minProgress;
+    auto minRadius = settings.minRadius;
+
+    long long minX = numeric_limits<int>::max(), minY = minX, maxX = numeric_limits<int>::min(), maxY = maxX;
+    for (auto& poly: safeArea) {
+        for (auto& p: poly) {
+            minX = min(minX, (long long)x(p));
+            minY = min(minY, (long long)y(p));
+            maxX = max(maxX, (long long)x(p));
+            maxY = max(maxY, (long long)y(p));
+        }
+    }
+
+    EdgeBvh<Point> safeAreaEdges(safeArea);
+    unique_ptr<CutRaster> raster;
+    if (settings.rasterCellSize > 0) {
+        int margin = r + 1;
+        raster.reset(new CutRaster({int(minX - margin), int(minY - margin)}, {int(maxX + margin), int(maxY + margin)}, settings.rasterCellSize));
+    }
+
+    // Where the cutter's center may go: the safe area without features narrower than
+    // 2 * minRadius
+    PolygonSet reachable = offset(offset(safeArea, -minRadius, arcTolerance, true), minRadius, arcTolerance, true);
+    simplify(reachable, precision, true);
+
+    PolygonSet front;
+    PolygonSet back;
+    auto addPaths = [&](const PolygonSet& paths) {
+        // The back also takes the front as it was before these paths, which fills the gaps
+        // between the bands of successive layers
+        auto backBand = offset(paths, minProgress, arcTolerance, false);
+        backBand.insert(backBand.end(), front.begin(), front.end());
+        back = combinePolygonSet(back, backBand, makeCombinePolygonSetCondition([](int w1, int w2){return w1 > 0 || w2 > 0; }));
+        simplify(back, precision, true);
+
+        auto band = combinePolygonSet(
+            offset(paths, stepover, arcTolerance, false), reachable,
+            makeCombinePolygonSetCondition([](int w1, int w2){return w1 > 0 && w2 > 0; }));
+        front = combinePolygonSet(front, band, makeCombinePolygonSetCondition([](int w1, int w2){return w1 > 0 || w2 > 0; }));
+        simplify(front, precision, true);
+        sink.add(paths);
+    };
+
+    // Each layer advances at least minProgress, so this only stops runaway loops
+    long long maxLayers = (maxX - minX + maxY - minY) / max(minProgress, 1) + 2;
+
+    // Any circle of at least minRadius in the safe area is also in reachable, which
+    // doesn't leave slivers along the walls when the front is taken out
+    PolygonSet uncut = reachable;
+    for (bool first = true; !uncut.empty(); first = false) {
+        Point center;
+        double radius = 0;
+        bool found = false;
+        if (first && start) {
+            center = *start;
+            double dist2;
+            safeAreaEdges.nearest(center, dist2);
+            radius = sqrt(dist2);
+            found = radius >= max(minRadius, 1);
+        }
+        if (!found && !(largestInscribedCircle(uncut, center, radius) && radius >= max(minRadius, 1)))
+            break;
+
+        Polygon spiral = createSpiral(stepover, x(center), y(center), radius);
+        trimSpiral(spiral, safeAreaEdges);
+        if (spiral.size() < 2)
+            break;
+        if (raster)
+            raster->stamp(spiral, r);
+        currentPos = spiral.back();
+        addPaths(PolygonSet{spiral});
+
+        for (long long layer = 0; layer < maxLayers; ++layer) {
+            CAM_PROFILE_COUNT("hspocket.layers", 1);
+            auto layerPaths = clipLoops(front, back);
+            if (layerPaths.empty())
+                break;
+            layerPaths = orderPaths(move(layerPaths), currentPos);
+            if (raster) {
+                CAM_PROFILE_ZONE("hspocket raster");
+                for (auto& path: layerPaths) {
+                    trimToNewMaterial(path, *raster, r);
+                    raster->stamp(path, r);
+                }
+                layerPaths.erase(remove_if(layerPaths.begin(), layerPaths.end(), [](const Polygon& p){return p.empty(); }), layerPaths.end());
+                if (layerPaths.empty())
+                    break;
+            }
+            addPaths(layerPaths);
+        }
+
+        // The front covers everything this entry reached
+        uncut = combinePolygonSet(uncut, front, makeCombinePolygonSetCondition([](int w1, int w2){return w1 > 0 && w2 <= 0; }));
+    }
+}
+
+// Clears each connected region of safeArea in turn, starting with the one holding the
+// start point if there is one.
+void cam::hspocketPaths(const PolygonSet& safeArea, double cutterDia, const double* options, PathSink& sink)
+{
+    CAM_PROFILE_ZONE("hspocket");
+    ArenaScope arena;
+    HspocketSettings settings(cutterDia, options);
+    if (safeArea.empty())
+        return;
+
+    auto components = splitComponents(safeArea);
+    size_t startComponent = components.size();
+    if (settings.hasStart) {
+        for (size_t i = 0; i < components.size() && startComponent == components.size(); ++i)
+            if (componentContains(components[i], settings.start))
+                startComponent = i;
+        if (startComponent < components.size())
+            rotate(components.begin(), components.begin() + startComponent, components.begin() + startComponent + 1);
+    }
+
+    Point currentPos = settings.hasStart ? settings.start : Point{0, 0};
+    for (size_t i = 0; i < components.size(); ++i)
+        clearComponent(components[i], cutterDia, settings, i == 0 && startComponent < components.size() ? &settings.start : nullptr, currentPos, sink);
+}
+
+static void hspocketPaths(const int* paths, double cutterDia, const double* options, PathSink& sink)
+{
+    PolygonSet safeArea;
+    {
+        ArenaScope arena;
+        safeArea = offset(convertPathsFromFlat(paths), -cutterDia / 2, arcTolerance, true);
+    }
+    hspocketPaths(safeArea, cutterDia, options, sink);
 }
 
 extern "C" void hspocket(
-    double** paths, int numPaths, int* pathSizes, double cutterDia,
-    double**& resultPaths, int& resultNumPaths, int*& resultPathSizes
+    const int* paths, double cutterDia, const double* options,
+    int*& resultPaths
     )
 {
+    resultPaths = nullptr;
     try {
-        PolygonSet geometry = convertPathsFromC(paths, numPaths, pathSizes);
-
-        int startX = lround(67 / 25.4 * inchToClipperScale);
-        int startY = lround(72 / 25.4 * inchToClipperScale);
-        int stepover = cutterDia / 4;
-        double spiralR = 60 / 25.4 * inchToClipperScale;
-        //int minRadius = cutterDia / 2;
-        int minRadius = cutterDia / 8;
-        int minProgress = lround(stepover / 8);
-        int precision = lround(inchToClipperScale / 5000);
-
-        PolygonSet safeArea = offset(geometry, -cutterDia / 2, arcTolerance, true);
-        //convertPathsToC(resultPaths, resultNumPaths, resultPathSizes, safeArea, true);
-        //return;
-
-        Polygon spiral = createSpiral(stepover, startX, startY, spiralR);
-        trimSpiral(spiral, safeArea);
-        //convertPathsToC(resultPaths, resultNumPaths, resultPathSizes, {spiral}, true);
-        //return;
-
-        PolygonSet cutterPaths;
-        cutterPaths.push_back(move(spiral));
-        PolygonSet cutArea = offset(cutterPaths, cutterDia / 2, arcTolerance, false);
-
-        //convertPathsToC(resultPaths, resultNumPaths, resultPathSizes, cutArea, true);
-        //return;
-
-        //int currentX, currentY;
-        //auto updateCurrentPos = [&]() {
-        //    auto& lastPath = cutterPaths.back();
-        //    auto& lastPos = lastPath.back();
-        //    currentX = x(lastPos);
-        //    currentY = y(lastPos);
-        //};
-        //updateCurrentPos();
-
-        auto loopStartTime = std::chrono::high_resolution_clock::now();
-
-        //int yyy = 200-40+5-50;
-        int yyy = 30-15;
-        int xxx = 0;
-//        while (true) {
-            printf("%d\n", xxx);
-            ++xxx;
-            //if (xxx >= yyy)
-            //    break;
-            auto front = offset(cutArea, -cutterDia / 2 + stepover, arcTolerance, true);
-            //auto back = offset(cutArea, -cutterDia / 2 + minProgress);
-            auto back = offset(front, minProgress - stepover, arcTolerance, true);
-
-            //auto q = safeArea;
-            auto q = combinePolygonSet(front, safeArea, makeCombinePolygonSetCondition([](int w1, int w2){return w1 > 0 && w2 > 0; }));
-            q = offset(q, -minRadius, arcTolerance, true);
-            q = offset(q, minRadius, arcTolerance, true);
-
-            convertPathsToC(resultPaths, resultNumPaths, resultPathSizes, q, true);
-            return;
+        PathSink sink(true);
+        hspocketPaths(paths, cutterDia, options, sink);
+        resultPaths = sink.release();
+    }
+    catch (exception& e) {
+        printf("%s\n", e.what());
+    }
+    catch (...) {
+        printf("???? unknown exception\n");
+    }
+};
 
-//            printf("/a\n");
-//
-//            Clipper clipper;
-//            clipper.AddPaths(q, ptSubject, false);
-//            clipper.AddPaths(back, ptClip, true);
-//            PolyTree result;
-//            clipper.Execute(ctDifference, result, pftEvenOdd, pftEvenOdd);
-//
-//            printf("/b\n");
-//
-//            if (xxx >= yyy) {
-//                //convertPathsToC(resultPaths, resultNumPaths, resultPathSizes, q);
-//                Paths p;
-//                for (auto child: result.Childs)
-//                    p.push_back(move(child->Contour));
-//                convertPathsToC(resultPaths, resultNumPaths, resultPathSizes, p);
-//                return;
-//            }
-//
-//
-//            //for (auto child: result.Childs) {
-//            //    auto& path = child->Contour;
-//            //    for (auto& orig: q) {
-//            //        if (path.back() == orig.back())
-//            //            path.push_back(orig.front());
-//            //        else if (path.front() == orig.front())
-//            //            path.insert(path.begin(), orig.back());
-//            //    }
-//            //}
-//
-//            vector<pair<Path, Path*>> frontPaths;
-//            vector<pair<Path, Path*>> backPaths;
-//            Paths combinedPaths;
-//            for (auto child: result.Childs) {
-//                auto& path = child->Contour;
-//                bool found = false;
-//                for (auto& existing: q) {
-//                    if (existing.front() == path.front()) {
-//                        //if (xxx >= yyy) {
-//                        //    cutterPaths.clear();
-//                        //    cutterPaths.push_back(move(path));
-//                        //    convertPathsToC(resultPaths, resultNumPaths, resultPathSizes, cutterPaths);
-//                        //    return;
-//                        //}
-//                        frontPaths.push_back(make_pair(move(path), &existing));
-//                        found = true;
-//                        printf("found front\n");
-//                        break;
-//                    }
-//                    //?else if (existing.front() == path.front()) {
-//                    //?    //if (xxx >= yyy) {
-//                    //?    //    cutterPaths.clear();
-//                    //?    //    cutterPaths.push_back(move(path));
-//                    //?    //    convertPathsToC(resultPaths, resultNumPaths, resultPathSizes, cutterPaths);
-//                    //?    //    return;
-//                    //?    //}
-//                    //?    frontPaths.push_back(make_pair(move(path), &existing));
-//                    //?    found = true;
-//                    //?    printf("found front\n");
-//                    //?    break;
-//                    //?}
-//                    else if (existing.back() == path.back()) {
-//                        backPaths.push_back(make_pair(move(path), &existing));
-//                        found = true;
-//                        printf("found back\n");
-//                        break;
-//                    }
-//                }
-//                if (!found)
-//                    combinedPaths.push_back(move(path));
-//            }
-//
-//            printf("/c\n");
-//
-//
-//            //if (xxx >= yyy) {
-//            //    //cutterPaths.clear();
-//            //    //cutterPaths.push_back(move(combinedPaths.front()));
-//            //    //convertPathsToC(resultPaths, resultNumPaths, resultPathSizes, cutterPaths);
-//            //    convertPathsToC(resultPaths, resultNumPaths, resultPathSizes, combinedPaths);
-//            //    return;
-//            //}
-//
-//            printf("/d\n");
-//
-//            for (auto& frontPath: frontPaths) {
-//                auto it = find_if(backPaths.begin(), backPaths.end(), [&frontPath](pair<Path, Path*>& p){return p.second == frontPath.second; });
-//                if (it != backPaths.end()) {
-//                    auto& backPath = it->first;
-//                    backPath.insert(backPath.end(), frontPath.first.begin(), frontPath.first.end());
-//                    combinedPaths.push_back(move(backPath));
-//                    backPaths.erase(it);
-//                }
-//                else
-//                    combinedPaths.push_back(move(frontPath.first));
-//            }
-//
-//            //if (xxx >= yyy) {
-//            //    //cutterPaths.clear();
-//            //    //cutterPaths.push_back(move(combinedPaths.front()));
-//            //    //convertPathsToC(resultPaths, resultNumPaths, resultPathSizes, cutterPaths);
-//            //    convertPathsToC(resultPaths, resultNumPaths, resultPathSizes, combinedPaths);
-//            //    return;
-//            //}
-//
-//
-//
-//            printf("/e\n");
-//
-//            //    bool merged = false;
-//            //    for (auto& existing: combinedPaths) {
-//            //        if (existing.back() == path.front()) {
-//            //            printf("!1\n");
-//            //            existing.insert(existing.end(), path.begin(), path.end());
-//            //            merged = true;
-//            //            break;
-//            //        }
-//            //        else if (existing.front() == path.back()) {
-//            //            printf("!2\n");
-//            //            path.insert(path.end(), existing.begin(), existing.end());
-//            //            existing = move(path);
-//            //            merged = true;
-//            //            break;
-//            //        }
-//            //    }
-//            //    if (!merged)
-//            //        combinedPaths.push_back(move(path));
-//            //}
-//
-//            //if (xxx >= yyy) {
-//            //    cutterPaths = combinedPaths;
-//            //    for (auto& path: combinedPaths) {
-//            //        printf("f: %lld, %lld\n", path.front().X, path.front().Y);
-//            //        printf(" : %lld, %lld\n", (++path.begin())->X, (++path.begin())->Y);
-//            //        printf(" : %lld, %lld\n", (--path.end())->X, (--path.end())->Y);
-//            //        printf("b: %lld, %lld\n", path.back().X, path.back().Y);
-//            //    }
-//            //    cutterPaths.insert(cutterPaths.end(), back.begin(), back.end());
-//            //    break;
-//            //}
-//
-//            printf("/f\n");
-//
-//            vector<CandidatePath> candidates;
-//            for (auto& path: combinedPaths) {
-//                double d = dist(path.back().X, path.back().Y, currentX, currentY);
-//                candidates.push_back({move(path), d});
-//            }
-//            make_heap(candidates.begin(), candidates.end(), [](CandidatePath& a, CandidatePath& b){return a.distToCurrentPos > b.distToCurrentPos; });
-//
-//            printf("/g\n");
-//
-//            bool found = false;
-//            while (!found && !candidates.empty()) {
-//                auto& newCutterPath = candidates.front().path;
-//                reverse(newCutterPath.begin(), newCutterPath.end());
-//                // corrupts open: CleanPolygon(newCutterPath, precision);
-////auto ccc = newCutterPath;
-//                auto newCutArea = offset(newCutterPath, cutterDia / 2, jtRound, etOpenRound);
-//                if (!clip(newCutArea, cutArea, ctDifference).empty()) {
-//
-//                    //if (xxx >= yyy) {
-//                    //    cutterPaths.clear();
-//                    //    //cutterPaths.push_back(move(newCutterPath));
-//                    //    cutterPaths.push_back(move(ccc));
-//                    //    convertPathsToC(resultPaths, resultNumPaths, resultPathSizes, cutterPaths);
-//                    //    return;
-//                    //}
-//
-//
-//                    cutterPaths.push_back(move(newCutterPath));
-//                    cutArea = clip(cutArea, newCutArea, ctUnion);
-//                    updateCurrentPos();
-//                    found = true;
-//                }
-//                else {
-//                    pop_heap(candidates.begin(), candidates.end(), [](CandidatePath& a, CandidatePath& b){return a.distToCurrentPos > b.distToCurrentPos; });
-//                    candidates.pop_back();
-//                }
-//            }
-//
-//            printf("/h\n");
-//
-//            if (!found)
-//                break;
-//
-//            if (xxx >= yyy) {
-//                //cutterPaths = cutArea.concat(newCutArea);
-//                break;
-//            }
-//        }
+extern "C" void hspocketStream(
+    const int* paths, double cutterDia, const double* options,
+    PathsCallback callback, void* context)
+{
+    try {
+        PathSink sink(callback, context, true);
+        hspocketPaths(paths, cutterDia, options, sink);
+        sink.flush();
+    }
+    catch (exception& e) {
+        printf("%s\n", e.what());
+    }
+    catch (...) {
+        printf("???? unknown exception\n");
+    }
+};
 
-        //console.log("hspocket loop: " + (Date.now() - loopStartTime));
-        printf("hspocket loop: %d\n", (int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - loopStartTime).count());
+extern "C" void hspocketGeometry(
+    int geometry, double cutterDia, const double* options,
+    int*& resultPaths)
+{
+    resultPaths = nullptr;
+    try {
+        Geometry* g = findGeometry(geometry);
+        if (!g)
+            return;
+        PathSink sink(true);
+        hspocketPaths(g->offset(-cutterDia / 2), cutterDia, options, sink);
+        resultPaths = sink.release();
+    }
+    catch (exception& e) {
+        printf("%s\n", e.what());
+    }
+    catch (...) {
+        printf("???? unknown exception\n");
+    }
+};
 
-        convertPathsToC(resultPaths, resultNumPaths, resultPathSizes, cutterPaths);
+extern "C" void hspocketGeometryStream(
+    int geometry, double cutterDia, const double* options,
+    PathsCallback callback, void* context)
+{
+    try {
+        Geometry* g = findGeometry(geometry);
+        if (!g)
+            return;
+        PathSink sink(callback, context, true);
+        hspocketPaths(g->offset(-cutterDia / 2), cutterDia, options, sink);
+        sink.flush();
     }
     catch (exception& e) {
         printf("%s\n", e.what());
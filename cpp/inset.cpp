@@ -0,0 +1,385 @@
+// Copyright 2014 Todd Fleming
+//
+// This file is part of jscut.
+//
+// jscut is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// jscut is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with jscut.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "geometry.h"
+
+using namespace cam;
+using namespace FlexScan;
+using namespace std;
+
+// An inset's boundary is where the distance to the geometry's boundary is amount. Inside a
+// segment's Voronoi cell that distance is the distance to the segment's line, so the
+// boundary is a line parallel to it; inside a vertex's cell it's a circle around the
+// vertex. The boundary passes from cell to cell where it crosses a Voronoi edge, and the
+// distance along an edge is convex, so an edge crosses it at most twice.
+//
+// Whether a Voronoi vertex is at least amount away ("above") is decided once per vertex,
+// so every edge meeting there agrees on it. Walking a cell's edges counterclockwise, the
+// crossings then alternate up and down. The points above amount on the cell's far side
+// from its site lie between an up crossing and the next down one, and the boundary runs
+// back across the cell from that down crossing to the up one, keeping them on its left.
+// Each crossing is down in one of its edge's cells and up in the other, so following
+// those links closes each polygon.
+
+namespace {
+
+using VoronoiCell = bp::voronoi_cell<double>;
+using VoronoiEdge = bp::voronoi_edge<double>;
+using VoronoiVertex = bp::voronoi_vertex<double>;
+
+struct DoublePoint {
+    double x, y;
+};
+
+// One part's crossings
+struct InsetCrossings {
+    // Crossing points, grouped by edge; each twin pair's are in the even edge's direction
+    ArenaVector<DoublePoint> points;
+
+    // Crossings of twin pair i are [first[i], first[i + 1])
+    ArenaVector<size_t> first;
+
+    // The crossing the boundary runs to next, and the cell it runs through to get there.
+    // none until linked.
+    ArenaVector<size_t> next;
+    ArenaVector<const VoronoiCell*> cell;
+};
+
+const size_t none = numeric_limits<size_t>::max();
+
+} // namespace
+
+static Point sitePoint(const MedialAxisPart& part, const VoronoiCell& cell)
+{
+    auto& segment = part.segments[cell.source_index()];
+    return cell.source_category() == bp::SOURCE_CATEGORY_SEGMENT_START_POINT ? low(segment) : high(segment);
+}
+
+// Distance from p to cell's site; a segment's line stands in for the segment, as it's the
+// nearest part of it anywhere in its cell
+static double siteDistance(const MedialAxisPart& part, const VoronoiCell& cell, DoublePoint p)
+{
+    if (cell.contains_point()) {
+        Point site = sitePoint(part, cell);
+        return hypot(p.x - x(site), p.y - y(site));
+    }
+    auto& segment = part.segments[cell.source_index()];
+    double dx = x(high(segment)) - x(low(segment));
+    double dy = y(high(segment)) - y(low(segment));
+    return fabs(dx * (p.y - y(low(segment))) - dy * (p.x - x(low(segment)))) / hypot(dx, dy);
+}
+
+// The part of an edge inside the geometry, and whether each end is above amount
+struct Stretch {
+    DoublePoint a, b;
+    bool aAbove, bAbove;
+};
+
+// edge's stretch, given its vertices' sides. A secondary edge through a vertex between
+// collinear segments, or out through a vertex to infinity, stops at the vertex.
+static Stretch insideStretch(const MedialAxisPart& part, const VoronoiEdge& edge, bool aAbove, bool bAbove)
+{
+    Stretch stretch{{}, {}, aAbove, bAbove};
+    auto& a = stretch.a;
+    auto& b = stretch.b;
+    if (edge.vertex0())
+        a = {edge.vertex0()->x(), edge.vertex0()->y()};
+    if (edge.vertex1())
+        b = {edge.vertex1()->x(), edge.vertex1()->y()};
+    if (!edge.is_secondary())
+        return stretch;
+
+    auto& pointCell = edge.cell()->contains_point() ? *edge.cell() : *edge.twin()->cell();
+    auto& segmentCell = edge.cell()->contains_point() ? *edge.twin()->cell() : *edge.cell();
+    Point p = sitePoint(part, pointCell);
+    DoublePoint vertex{double(x(p)), double(y(p))};
+    if (!edge.vertex0() || !edge.vertex1()) {
+        (edge.vertex0() ? b : a) = vertex;
+        (edge.vertex0() ? stretch.bAbove : stretch.aAbove) = false;
+        return stretch;
+    }
+    if ((a.x - vertex.x) * (b.x - vertex.x) + (a.y - vertex.y) * (b.y - vertex.y) >= 0 ||
+        hypot(a.x - vertex.x, a.y - vertex.y) < 1 || hypot(b.x - vertex.x, b.y - vertex.y) < 1)
+        return stretch;
+    auto& segment = part.segments[segmentCell.source_index()];
+    double aCross =
+        ((double)x(high(segment)) - x(low(segment))) * (a.y - y(low(segment))) -
+        ((double)y(high(segment)) - y(low(segment))) * (a.x - x(low(segment)));
+    if ((aCross > 0) == part.insideIsLeft) {
+        b = vertex;
+        stretch.bAbove = false;
+    }
+    else {
+        a = vertex;
+        stretch.aAbove = false;
+    }
+    return stretch;
+}
+
+// Append the crossings on edge's stretch, in its direction.
+//
+// A line's distance from a point is sqrt(u*u + h*h), u along the line; from another line
+// it's linear. A parabola's distance from its point and segment is (u*u + h*h) / (2*h), u
+// along the segment. Both ends above may hide two crossings around the nearest point; one
+// above and one below have one, on the side of the end above.
+static void edgeCrossings(
+    const MedialAxisPart& part, const VoronoiEdge& edge, const Stretch& stretch, double amount,
+    ArenaVector<DoublePoint>& points)
+{
+    bool aAbove = stretch.aAbove, bAbove = stretch.bAbove;
+    if (!aAbove && !bAbove)
+        return;
+    auto a = stretch.a, b = stretch.b;
+    auto& cell = *edge.cell();
+    auto& twinCell = *edge.twin()->cell();
+
+    if (edge.is_curved()) {
+        auto& pointCell = cell.contains_point() ? cell : twinCell;
+        auto& segmentCell = cell.contains_point() ? twinCell : cell;
+        Point p = sitePoint(part, pointCell);
+        auto& segment = part.segments[segmentCell.source_index()];
+        double length = euclidean_distance(low(segment), high(segment));
+        double ex = (x(high(segment)) - x(low(segment))) / length;
+        double ey = (y(high(segment)) - y(low(segment))) / length;
+        double px = x(p) - x(low(segment)), py = y(p) - y(low(segment));
+        double up = px * ex + py * ey;
+        double h = px * -ey + py * ex;
+        double side = h < 0 ? -1 : 1;
+        h = fabs(h);
+        if (h == 0)
+            return;
+        auto along = [&](DoublePoint q) { return (q.x - x(low(segment))) * ex + (q.y - y(low(segment))) * ey; };
+        double ua = along(a), ub = along(b);
+        double r = sqrt(max(0.0, 2 * h * amount - h * h));
+        auto emit = [&](double u) {
+            u = min(max(u, min(ua, ub)), max(ua, ub));
+            points.push_back({
+                x(low(segment)) + u * ex - side * amount * ey,
+                y(low(segment)) + u * ey + side * amount * ex});
+        };
+        if (aAbove != bAbove)
+            emit(up + ((aAbove ? ua : ub) < up ? -r : r));
+        else if (min(ua, ub) < up && up < max(ua, ub) && h < 2 * amount) {
+            double toward = ub > ua ? 1 : -1;
+            emit(up - toward * r);
+            emit(up + toward * r);
+        }
+        return;
+    }
+
+    double length = hypot(b.x - a.x, b.y - a.y);
+    if (length == 0)
+        return;
+    auto at = [&](double s) {
+        s = min(max(s, 0.0), length);
+        points.push_back({a.x + (b.x - a.x) * s / length, a.y + (b.y - a.y) * s / length});
+    };
+
+    if (cell.contains_segment() || twinCell.contains_segment()) {
+        auto& segmentCell = cell.contains_segment() ? cell : twinCell;
+        if (aAbove != bAbove) {
+            double fa = siteDistance(part, segmentCell, a);
+            double fb = siteDistance(part, segmentCell, b);
+            at(fa == fb ? length / 2 : (amount - fa) / (fb - fa) * length);
+        }
+        return;
+    }
+
+    Point p = sitePoint(part, cell);
+    double dx = (b.x - a.x) / length, dy = (b.y - a.y) / length;
+    double u0 = (a.x - x(p)) * dx + (a.y - y(p)) * dy;
+    double h = (a.x - x(p)) * dy - (a.y - y(p)) * dx;
+    double r = sqrt(max(0.0, amount * amount - h * h));
+    if (aAbove != bAbove)
+        at(-u0 + (bAbove ? r : -r));
+    else if (-u0 > 0 && -u0 < length && fabs(h) < amount) {
+        at(-u0 - r);
+        at(-u0 + r);
+    }
+}
+
+// Find part's crossings and link them up
+static void findCrossings(const MedialAxisPart& part, double amount, InsetCrossings& crossings)
+{
+    auto& vd = part.diagram;
+    auto& edges = vd.edges();
+    auto vertexIndex = [&vd](const VoronoiVertex* vertex) {
+        return size_t(vertex - &vd.vertices()[0]);
+    };
+    auto edgeIndex = [&edges](const VoronoiEdge* edge) {
+        return size_t(edge - &edges[0]);
+    };
+
+    ArenaVector<char> above(vd.vertices().size());
+    for (size_t i = 0; i < vd.vertices().size(); ++i) {
+        auto& vertex = vd.vertices()[i];
+        above[i] = siteDistance(part, *vertex.incident_edge()->cell(), {vertex.x(), vertex.y()}) >= amount;
+    }
+
+    // Whether each edge starts above amount, where its stretch starts
+    ArenaVector<char> startAbove(edges.size());
+    for (size_t i = 0; i < edges.size(); i += 2) {
+        crossings.first.push_back(crossings.points.size());
+        auto& edge = edges[i];
+        if (!part.edgeInside[i])
+            continue;
+        auto stretch = insideStretch(
+            part, edge,
+            edge.vertex0() && above[vertexIndex(edge.vertex0())],
+            edge.vertex1() && above[vertexIndex(edge.vertex1())]);
+        startAbove[i] = stretch.aAbove;
+        startAbove[i + 1] = stretch.bAbove;
+        edgeCrossings(part, edge, stretch, amount, crossings.points);
+    }
+    crossings.first.push_back(crossings.points.size());
+    crossings.next.assign(crossings.points.size(), none);
+    crossings.cell.assign(crossings.points.size(), nullptr);
+
+    struct Visit {
+        size_t crossing;
+        bool up;
+    };
+    ArenaVector<Visit> visits;
+    for (auto& cell: vd.cells()) {
+        if (cell.is_degenerate())
+            continue;
+        visits.clear();
+        auto edge = cell.incident_edge();
+        do {
+            size_t i = edgeIndex(edge);
+            if (part.edgeInside[i]) {
+                size_t begin = crossings.first[i / 2], end = crossings.first[i / 2 + 1];
+                bool isAbove = startAbove[i];
+                for (size_t j = 0; j < end - begin; ++j) {
+                    isAbove = !isAbove;
+                    visits.push_back({i & 1 ? end - 1 - j : begin + j, isAbove});
+                }
+            }
+            edge = edge->next();
+        } while (edge != cell.incident_edge());
+
+        for (size_t i = 0; i < visits.size(); ++i) {
+            auto& down = visits[i + 1 < visits.size() ? i + 1 : 0];
+            if (!visits[i].up)
+                continue;
+            if (down.up) {
+                CAM_PROFILE_COUNT("medialAxisInset.unpaired", 1);
+                continue;
+            }
+            crossings.next[down.crossing] = visits[i].crossing;
+            crossings.cell[down.crossing] = &cell;
+        }
+    }
+}
+
+// Append to result the polygons part's crossings link into
+static void traceInset(const MedialAxisPart& part, const InsetCrossings& crossings, double amount, double arcTolerance, PolygonSet& result)
+{
+    double arcStep = deltaAngleForError(arcTolerance, amount);
+    ArenaVector<char> traced(crossings.points.size());
+    for (size_t start = 0; start < crossings.points.size(); ++start) {
+        if (traced[start] || crossings.next[start] == none)
+            continue;
+        Polygon poly;
+        auto add = [&poly](double px, double py) {
+            Point p{int(lround(px)), int(lround(py))};
+            if (poly.empty() || p != poly.back())
+                poly.push_back(p);
+        };
+
+        // A mitered arc's ends are left out: its corner stands in for them
+        size_t i = start;
+        bool closed = false;
+        bool skipFrom = false;
+        bool startMitered = false;
+        while (!traced[i] && crossings.next[i] != none) {
+            traced[i] = true;
+            size_t next = crossings.next[i];
+            auto& from = crossings.points[i];
+            auto& to = crossings.points[next];
+
+            // A vertex's inside is narrower than a half turn; the boundary runs clockwise
+            // around it
+            auto& cell = *crossings.cell[i];
+            int numSegments = 0;
+            Point site;
+            double fromAngle = 0, sweep = 0;
+            if (cell.contains_point()) {
+                site = sitePoint(part, cell);
+                fromAngle = atan2(from.y - y(site), from.x - x(site));
+                sweep = fromAngle - atan2(to.y - y(site), to.x - x(site));
+                if (sweep < 0)
+                    sweep += 2 * M_PI;
+                if (sweep < M_PI)
+                    numSegments = ceil(sweep / arcStep);
+            }
+
+            if (numSegments == 1) {
+                // A single chord is within tolerance; the tangents' intersection is too,
+                // and is one vertex instead of two, as in rawOffset()
+                double q = cos(sweep);
+                add(x(site) + (from.x + to.x - 2 * x(site)) / (1 + q),
+                    y(site) + (from.y + to.y - 2 * y(site)) / (1 + q));
+                startMitered = startMitered || i == start;
+            }
+            else {
+                if (!skipFrom)
+                    add(from.x, from.y);
+                for (int j = 1; j < numSegments; ++j) {
+                    double angle = fromAngle - sweep * j / numSegments;
+                    add(x(site) + amount * cos(angle), y(site) + amount * sin(angle));
+                }
+            }
+            skipFrom = numSegments == 1;
+
+            i = next;
+            closed = i == start;
+        }
+        if (!closed) {
+            CAM_PROFILE_COUNT("medialAxisInset.open", 1);
+            continue;
+        }
+        if (skipFrom && !startMitered && !poly.empty())
+            poly.erase(poly.begin());
+        if (poly.size() > 1 && poly.front() == poly.back())
+            poly.pop_back();
+        if (poly.size() >= 3)
+            result.push_back(move(poly));
+    }
+}
+
+PolygonSet cam::medialAxisInset(const MedialAxis& medialAxis, double amount, double arcTolerance, const ExecutionPolicy& policy)
+{
+    CAM_PROFILE_ZONE("medialAxisInset");
+    if (amount <= 0)
+        return {};
+
+    vector<PolygonSet> parts(medialAxis.parts.size());
+    parallelFor(policy, parts.size(), [&](size_t i) {
+        ArenaScope arena;
+        InsetCrossings crossings;
+        findCrossings(medialAxis.parts[i], amount, crossings);
+        CAM_PROFILE_COUNT("medialAxisInset.crossings", crossings.points.size());
+        traceInset(medialAxis.parts[i], crossings, amount, arcTolerance, parts[i]);
+    });
+
+    PolygonSet result;
+    for (auto& part: parts)
+        for (auto& poly: part)
+            result.push_back(move(poly));
+    return result;
+}
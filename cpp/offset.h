@@ -32,7 +32,7 @@ static Polygon rawOffset(const Polygon& path, UnitFromPolygon_t<Polygon> amount,
     if (path.size() < 2)
         return{};
 
-    auto startTime = std::chrono::high_resolution_clock::now();
+    CAM_PROFILE_ZONE("rawOffset");
 
     auto processSegment = [arcTolerance](Polygon& raw, const Point& p0, const Point& p1, const Point& p2, int amount) {
         if (p1 == p0)
@@ -40,24 +40,36 @@ static Polygon rawOffset(const Polygon& path, UnitFromPolygon_t<Polygon> amount,
 
         auto getNormal = [](const Point& p1, const Point& p2, int amount) -> Point {
             double length = euclidean_distance(p1, p2);
-            return{lround(double(y(p2)-y(p1))*amount/length), lround(double(x(p1)-x(p2))*amount/length)};
+            return{Unit(lround(double(y(p2)-y(p1))*amount/length)), Unit(lround(double(x(p1)-x(p2))*amount/length))};
         };
 
         auto normal01 = getNormal(p0, p1, amount);
         auto normal12 = getNormal(p1, p2, amount);
+
         auto o = orientation(Segment{p1, {x(p1)+x(normal01), y(p1)+y(normal01)}}, Segment{p1, {x(p1)+x(normal12), y(p1)+y(normal12)}});
         if (amount < 0)
             o = -o;
 
         // turn left
         if (o == 1 || o == 0 && dot(normal01, normal12) < 0) {
-            raw.push_back({x(p1)+x(normal01), y(p1)+y(normal01)});
-
-            double baseAngle = atan2(y(normal01), x(normal01));
             double q = ((double)x(normal01)*x(normal12) + (double)y(normal01)*y(normal12)) / amount / amount;
             q = std::min(1.0, std::max(-1.0, q));
             double sweepAngle = acos(q);
             int numSegments = ceil(sweepAngle / deltaAngleForError(arcTolerance, labs(amount)));
+
+            // A single arc segment is within tolerance; the offset edges' intersection is
+            // too, and is one vertex instead of two. Offsetting an offset would otherwise
+            // double the vertices of every arc.
+            if (numSegments <= 1) {
+                raw.push_back({
+                    Unit(lround(x(p1) + (x(normal01)+x(normal12)) / (1+q))),
+                    Unit(lround(y(p1) + (y(normal01)+y(normal12)) / (1+q)))});
+                return;
+            }
+
+            raw.push_back({x(p1)+x(normal01), y(p1)+y(normal01)});
+
+            double baseAngle = atan2(y(normal01), x(normal01));
             if (amount < 0) {
                 baseAngle += M_PI;
                 sweepAngle = -sweepAngle;
@@ -65,7 +77,7 @@ static Polygon rawOffset(const Polygon& path, UnitFromPolygon_t<Polygon> amount,
 
             for (int i = 1; i < numSegments; ++i) {
                 double angle = baseAngle + sweepAngle*i/numSegments;
-                raw.push_back({lround(x(p1)+amount*cos(angle)), lround(y(p1)+amount*sin(angle))});
+                raw.push_back({Unit(lround(x(p1)+amount*cos(angle))), Unit(lround(y(p1)+amount*sin(angle)))});
             }
 
             raw.push_back({x(p1)+x(normal12), y(p1)+y(normal12)});
@@ -114,37 +126,175 @@ static Polygon rawOffset(const Polygon& path, UnitFromPolygon_t<Polygon> amount,
         }
     }
 
-    printf("rawOffset time: %d\n", (int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - startTime).count());
-
+    CAM_PROFILE_COUNT("rawOffset.vertices", raw.size());
     return raw;
 }
 
+// Polygons are independent; a parallel policy offsets them on worker threads. Order is kept.
 template<typename PolygonSet>
-static PolygonSet rawOffsetPolygonSet(const PolygonSet& ps, UnitFromPolygonSet_t<PolygonSet> amount, UnitFromPolygonSet_t<PolygonSet> arcTolerance, bool closed) {
-    PolygonSet result;
-    for (auto& poly: ps) {
-        auto raw = rawOffset(poly, amount, arcTolerance, closed);
-        result.push_back(move(raw));
-    }
+static PolygonSet rawOffsetPolygonSet(
+    const PolygonSet& ps, UnitFromPolygonSet_t<PolygonSet> amount, UnitFromPolygonSet_t<PolygonSet> arcTolerance, bool closed,
+    const ExecutionPolicy& policy = defaultExecutionPolicy())
+{
+    PolygonSet result(ps.size());
+    parallelFor(policy, ps.size(), [&](size_t i) {
+        result[i] = rawOffset(ps[i], amount, arcTolerance, closed);
+    });
     return result;
 }
 
 template<typename PolygonSet>
-static PolygonSet offset(const PolygonSet& ps, UnitFromPolygonSet_t<PolygonSet> amount, UnitFromPolygonSet_t<PolygonSet> arcTolerance, bool closed) {
-    using Polygon = PolygonFromPolygonSet_t<PolygonSet>;
+static PolygonSet offset(
+    const PolygonSet& ps, UnitFromPolygonSet_t<PolygonSet> amount, UnitFromPolygonSet_t<PolygonSet> arcTolerance, bool closed,
+    const ExecutionPolicy& policy = defaultExecutionPolicy())
+{
+    using Edge = CleanEdge_t<PointFromPolygonSet_t<PolygonSet>>;
+    using Scan = Scan<ScanlineEdge<Edge>>;
 
-    PolygonSet result;
-    for (auto& poly: ps) {
-        Polygon raw = rawOffset(poly, amount, arcTolerance, closed);
-        result.push_back(move(raw));
+    CAM_PROFILE_ZONE("offset");
+
+    // Raw offsets go straight to edges. Each run of polygons fills its own buffer; the buffers
+    // are concatenated in order and handed to the clean step.
+    size_t numRuns = policy.parallel() ? std::max(std::min(ps.size(), size_t(policy.numThreads) * 4), size_t(1)) : 1;
+    ArenaVector<ArenaVector<Edge>> runEdges(numRuns);
+    parallelFor(policy, numRuns, [&](size_t run) {
+        for (size_t i = ps.size() * run / numRuns; i < ps.size() * (run + 1) / numRuns; ++i) {
+            auto raw = rawOffset(ps[i], amount, arcTolerance, closed);
+            Scan::insertPoints(runEdges[run], raw.begin(), raw.end());
+        }
+    });
+
+    ArenaVector<Edge> edges = move(runEdges[0]);
+    if (numRuns > 1) {
+        size_t numEdges = 0;
+        for (auto& e: runEdges)
+            numEdges += e.size();
+        edges.reserve(numEdges + edges.size());
+        for (size_t run = 1; run < numRuns; ++run) {
+            edges.insert(edges.end(), runEdges[run].begin(), runEdges[run].end());
+            runEdges[run] = {};
+        }
     }
 
-    auto cleanStartTime = std::chrono::high_resolution_clock::now();
-    result = cleanPolygonSet(result, PositiveWinding{});
-    printf("offset clean time: %d\n", (int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - cleanStartTime).count());
-    printf("polys: %d\n", result.size());
+    auto result = cleanEdges<PolygonSet>(move(edges), PositiveWinding{}, policy);
+    CAM_PROFILE_COUNT("offset.polygons", result.size());
 
     return result;
 }
 
+// Successive offsets of ps: ring 0 is ps offset by first, and each ring after it is the
+// one before offset by step, until nothing is left (or after ring 0 if step is 0). Each
+// ring is made from the last as the iteration reaches it, in one edge buffer which is
+// kept from ring to ring. Each ring is still a raw offset of the previous ring followed by
+// a full clean of the result: O(m log m) for the m raw edges of that ring, so a series of
+// k rings costs the sum of those, not near-linear work overall. Reusing the buffer only
+// saves the per-ring allocation; no topology carries over from one ring to the next.
+//
+//      for (auto& ring: OffsetSeries<PolygonSet>(geometry, -cutterRadius, -stepover, arcTolerance))
+//
+// Uses the current ArenaScope, which must outlast it.
+template<typename PolygonSet>
+class OffsetSeries {
+public:
+    using Unit = UnitFromPolygonSet_t<PolygonSet>;
+    using Edge = CleanEdge_t<PointFromPolygonSet_t<PolygonSet>>;
+
+    class iterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = PolygonSet;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const PolygonSet*;
+        using reference = const PolygonSet&;
+
+        iterator() = default;
+
+        reference operator*() const { return series->current; }
+        pointer operator->() const { return &series->current; }
+
+        iterator& operator++()
+        {
+            series->next();
+            return *this;
+        }
+
+        bool operator==(const iterator& rhs) const { return atEnd() == rhs.atEnd(); }
+        bool operator!=(const iterator& rhs) const { return !(*this == rhs); }
+
+    private:
+        friend class OffsetSeries;
+        OffsetSeries* series = nullptr;
+
+        explicit iterator(OffsetSeries* series) :
+            series(series)
+        {
+        }
+
+        bool atEnd() const { return !series || series->done(); }
+    };
+
+    OffsetSeries(
+        const PolygonSet& ps, Unit first, Unit step, Unit arcTolerance,
+        const ExecutionPolicy& policy = defaultExecutionPolicy()) :
+        source(&ps),
+        first(first),
+        step(step),
+        arcTolerance(arcTolerance),
+        policy(policy)
+    {
+    }
+
+    OffsetSeries(const OffsetSeries&) = delete;
+    OffsetSeries& operator=(const OffsetSeries&) = delete;
+
+    // Start at ring 0. Only once; the series doesn't rewind.
+    iterator begin()
+    {
+        if (source)
+            next();
+        return iterator(this);
+    }
+
+    iterator end() { return iterator(); }
+
+    // Rings made so far, including the current one
+    size_t numRings() const { return count; }
+
+private:
+    const PolygonSet* source;
+    Unit first;
+    Unit step;
+    Unit arcTolerance;
+    ExecutionPolicy policy;
+
+    PolygonSet current;
+    size_t count = 0;
+    ArenaVector<Edge> edges;
+
+    bool done() const { return current.empty(); }
+
+    void next()
+    {
+        CAM_PROFILE_ZONE("OffsetSeries");
+        using Scan = Scan<ScanlineEdge<Edge>>;
+
+        const PolygonSet& from = source ? *source : current;
+        Unit amount = source ? first : step;
+        source = nullptr;
+        if (count && step == 0) {
+            current.clear();
+            return;
+        }
+
+        edges.clear();
+        for (auto& poly: from) {
+            auto raw = rawOffset(poly, amount, arcTolerance, true);
+            Scan::insertPoints(edges, raw.begin(), raw.end());
+        }
+        current = cleanEdgesInPlace<PolygonSet>(edges, PositiveWinding{}, policy);
+        if (!current.empty())
+            ++count;
+    }
+};
+
 } // namespace FlexScan
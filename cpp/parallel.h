@@ -0,0 +1,93 @@
+// Copyright 2014 Todd Fleming
+//
+// This file is part of jscut.
+//
+// jscut is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// jscut is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with jscut.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace FlexScan {
+
+// How many threads an operation may use. Results never depend on numThreads.
+//
+// The emscripten build has no threads, so the default stays sequential; native
+// builds raise it through defaultExecutionPolicy().
+struct ExecutionPolicy {
+    int numThreads;
+
+    explicit ExecutionPolicy(int numThreads = 1) :
+        numThreads(numThreads)
+    {
+    }
+
+    bool parallel() const
+    {
+        return numThreads > 1;
+    }
+};
+
+// Policy used when an operation isn't given one
+inline ExecutionPolicy& defaultExecutionPolicy()
+{
+    static ExecutionPolicy policy;
+    return policy;
+}
+
+// Call f(i) for each i in [0, n). Threads take the next i as they finish, so
+// calls may run concurrently and in any order. The first exception thrown by f
+// is rethrown once every thread has stopped.
+template<typename F>
+void parallelFor(const ExecutionPolicy& policy, size_t n, F f)
+{
+    size_t numThreads = std::min(size_t(std::max(policy.numThreads, 1)), n);
+    if (numThreads <= 1) {
+        for (size_t i = 0; i < n; ++i)
+            f(i);
+        return;
+    }
+
+    std::atomic<size_t> next{0};
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    auto worker = [&]() {
+        try {
+            for (size_t i; (i = next++) < n;)
+                f(i);
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!error)
+                error = std::current_exception();
+            next = n;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < numThreads; ++i)
+        threads.emplace_back(worker);
+    worker();
+    for (auto& thread: threads)
+        thread.join();
+    if (error)
+        std::rethrow_exception(error);
+}
+
+} // namespace FlexScan
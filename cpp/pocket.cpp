@@ -0,0 +1,212 @@
+// Copyright 2014 Todd Fleming
+//
+// This file is part of jscut.
+//
+// jscut is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// jscut is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with jscut.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "cam.h"
+#include "offset.h"
+
+using namespace cam;
+using namespace FlexScan;
+using namespace std;
+
+// Join closed paths into fewer cuts. From the end of the cut so far, take the remaining path
+// with the nearest point, starting it there and closing it. It joins the cut if the link
+// to it stays inside bounds; without bounds nothing joins. A cut is safe to close if its
+// closing link stays inside bounds too. Cuts go to sink, and a flag for each to
+// safeToClose.
+static void mergePaths(const EdgeBvh<Point>* bounds, const PolygonSet& paths, PathSink& sink, vector<int>& safeToClose)
+{
+    CAM_PROFILE_ZONE("mergePaths");
+    ArenaVector<Point> points;
+    ArenaVector<size_t> pathOf;
+    ArenaVector<size_t> firstPoint;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        firstPoint.push_back(points.size());
+        for (auto& point: paths[i]) {
+            points.push_back(point);
+            pathOf.push_back(i);
+        }
+    }
+    if (points.empty())
+        return;
+    PointKdTree<Point> tree(points.begin(), points.end());
+
+    Polygon cut;
+    auto take = [&](size_t point) {
+        size_t i = pathOf[point];
+        auto& path = paths[i];
+        size_t start = point - firstPoint[i];
+        for (size_t j = 0; j < path.size(); ++j)
+            tree.remove(firstPoint[i] + j);
+        cut.insert(cut.end(), path.begin() + start, path.end());
+        cut.insert(cut.end(), path.begin(), path.begin() + start + 1);
+    };
+    auto finish = [&]() {
+        safeToClose.push_back(bounds && bounds->containsSegment(cut.front(), cut.back()));
+        sink.add(cut);
+        cut.clear();
+    };
+
+    take(0);
+    while (tree.numLeft()) {
+        double dist2;
+        size_t point = tree.nearest(cut.back(), dist2);
+        if (!bounds || !bounds->containsSegment(cut.back(), points[point]))
+            finish();
+        take(point);
+    }
+    finish();
+}
+
+// rings is a list of ring sets, from the first cut to the last. Merges them last first.
+static void mergeRings(const PolygonSet& bounds, const vector<PolygonSet>& rings, PathSink& sink, vector<int>& safeToClose)
+{
+    PolygonSet paths;
+    for (auto it = rings.rbegin(); it != rings.rend(); ++it)
+        paths.insert(paths.end(), it->begin(), it->end());
+    EdgeBvh<Point> boundsEdges(bounds);
+    mergePaths(&boundsEdges, paths, sink, safeToClose);
+}
+
+static void reversePaths(PolygonSet& paths)
+{
+    for (auto& path: paths)
+        reverse(path.begin(), path.end());
+}
+
+// Conventional pocket: the geometry inset by the cutter radius, then each ring inset from
+// the one before by the stepover until nothing is left. overlap is in [0, 1).
+static void pocketPaths(const PolygonSet& geometry, double cutterDia, double overlap, bool climb, PathSink& sink, vector<int>& safeToClose)
+{
+    CAM_PROFILE_ZONE("pocket");
+    ArenaScope arena;
+    double stepover = max(cutterDia * (1 - overlap), 0.0);
+    vector<PolygonSet> rings;
+    PolygonSet bounds;
+    for (auto& ring: OffsetSeries<PolygonSet>(geometry, -cutterDia / 2, -stepover, arcTolerance)) {
+        if (rings.empty())
+            bounds = ring;
+        rings.push_back(ring);
+        if (climb)
+            reversePaths(rings.back());
+    }
+    mergeRings(bounds, rings, sink, safeToClose);
+}
+
+// Outline: rings from the cutter's edge at the geometry out to width away (in if isInside),
+// stepping by the stepover, the last one at width. Links between rings stay within that
+// band. overlap is in [0, 1).
+static void outlinePaths(const PolygonSet& geometry, double cutterDia, bool isInside, double width, double overlap, bool climb, PathSink& sink, vector<int>& safeToClose)
+{
+    CAM_PROFILE_ZONE("outline");
+    ArenaScope arena;
+    auto diff = [](const PolygonSet& a, const PolygonSet& b) {
+        return combinePolygonSet(a, b, makeCombinePolygonSetCondition([](int w1, int w2){return w1 > 0 && w2 <= 0; }));
+    };
+
+    double eachWidth = max(cutterDia * (1 - overlap), 0.0);
+    double direction = isInside ? -1 : 1;
+    bool needReverse = isInside ? climb : !climb;
+    PolygonSet outer = offset(geometry, direction * (width - cutterDia / 2), arcTolerance, true);
+
+    vector<PolygonSet> rings;
+    auto addRing = [&](PolygonSet ring) {
+        if (needReverse)
+            reversePaths(ring);
+        rings.push_back(move(ring));
+    };
+
+    // Full steps while they fit, then one short step to finish at width
+    PolygonSet first;
+    double currentWidth = cutterDia;
+    OffsetSeries<PolygonSet> series(geometry, direction * cutterDia / 2, direction * eachWidth, arcTolerance);
+    if (cutterDia <= width) {
+        for (auto& ring: series) {
+            if (rings.empty())
+                first = ring;
+            addRing(ring);
+            double nextWidth = currentWidth + eachWidth;
+            if (nextWidth > width) {
+                if (width > currentWidth)
+                    addRing(offset(ring, direction * (width - currentWidth), arcTolerance, true));
+                break;
+            }
+            currentWidth = nextWidth;
+        }
+    }
+    PolygonSet bounds = isInside ? diff(first, outer) : diff(outer, first);
+    mergeRings(bounds, rings, sink, safeToClose);
+}
+
+// safeToClose as a block the caller frees
+static int* releaseFlags(const vector<int>& flags)
+{
+    int* result = (int*)malloc(max(flags.size(), size_t(1)) * sizeof(int));
+    if (!result)
+        throw bad_alloc();
+    copy(flags.begin(), flags.end(), result);
+    return result;
+}
+
+extern "C" void pocket(
+    const int* paths, double cutterDia, double overlap, int climb,
+    int*& resultPaths, int*& resultSafeToClose)
+{
+    resultPaths = nullptr;
+    resultSafeToClose = nullptr;
+    try {
+        PathSink sink(false);
+        vector<int> safeToClose;
+        pocketPaths(convertPathsFromFlat(paths), cutterDia, overlap, climb, sink, safeToClose);
+        resultSafeToClose = releaseFlags(safeToClose);
+        resultPaths = sink.release();
+    }
+    catch (exception& e) {
+        free(resultSafeToClose);
+        resultSafeToClose = nullptr;
+        printf("%s\n", e.what());
+    }
+    catch (...) {
+        free(resultSafeToClose);
+        resultSafeToClose = nullptr;
+        printf("???? unknown exception\n");
+    }
+};
+
+extern "C" void outline(
+    const int* paths, double cutterDia, int isInside, double width, double overlap, int climb,
+    int*& resultPaths, int*& resultSafeToClose)
+{
+    resultPaths = nullptr;
+    resultSafeToClose = nullptr;
+    try {
+        PathSink sink(false);
+        vector<int> safeToClose;
+        outlinePaths(convertPathsFromFlat(paths), cutterDia, isInside, width, overlap, climb, sink, safeToClose);
+        resultSafeToClose = releaseFlags(safeToClose);
+        resultPaths = sink.release();
+    }
+    catch (exception& e) {
+        free(resultSafeToClose);
+        resultSafeToClose = nullptr;
+        printf("%s\n", e.what());
+    }
+    catch (...) {
+        free(resultSafeToClose);
+        resultSafeToClose = nullptr;
+        printf("???? unknown exception\n");
+    }
+};
@@ -0,0 +1,115 @@
+// Copyright 2014 Todd Fleming
+//
+// This file is part of jscut.
+//
+// jscut is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// jscut is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with jscut.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+// Scoped-zone profiling. Compiled out unless CAM_PROFILE is defined; the
+// macros below then expand to nothing.
+//
+//      CAM_PROFILE_ZONE("offset");                 // times the enclosing scope
+//      CAM_PROFILE_COUNT("offset.edges", n);       // adds n to a named counter
+//
+// Names must be string literals (or otherwise outlive the profile).
+
+#ifdef CAM_PROFILE
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace cam {
+namespace profile {
+
+struct ZoneRecord {
+    const char* name;
+    int thread;
+    int depth;
+    double startUs;
+    double durationUs;
+};
+
+struct CounterRecord {
+    const char* name;
+    long long value;
+};
+
+// Everything recorded since the last clear()
+struct Profile {
+    std::vector<ZoneRecord> zones;
+    std::vector<CounterRecord> counters;
+
+    // Total time spent in zones with this name
+    double totalMs(const char* name) const;
+
+    // Number of times a zone with this name was entered
+    int numCalls(const char* name) const;
+
+    // Current value of a counter; 0 if never counted
+    long long counter(const char* name) const;
+
+    void clear();
+
+    // {"zones":[{"name":..,"thread":..,"depth":..,"startUs":..,"durationUs":..},...],"counters":{"name":value,...}}
+    std::string toJson() const;
+
+    // chrome://tracing or https://ui.perfetto.dev
+    std::string toChromeTrace() const;
+};
+
+// The process-wide profile. Recording is thread safe; reading isn't, so
+// query it once the operation finishes.
+Profile& current();
+
+void recordZone(const char* name, std::chrono::high_resolution_clock::time_point start, int depth);
+void count(const char* name, long long n);
+int enterZone();
+
+struct ScopedZone {
+    const char* name;
+    int depth;
+    std::chrono::high_resolution_clock::time_point start;
+
+    explicit ScopedZone(const char* name) :
+        name(name),
+        depth(enterZone()),
+        start(std::chrono::high_resolution_clock::now())
+    {
+    }
+
+    ScopedZone(const ScopedZone&) = delete;
+    ScopedZone& operator=(const ScopedZone&) = delete;
+
+    ~ScopedZone()
+    {
+        recordZone(name, start, depth);
+    }
+};
+
+} // namespace profile
+} // namespace cam
+
+#define CAM_PROFILE_CONCAT2(a, b) a##b
+#define CAM_PROFILE_CONCAT(a, b) CAM_PROFILE_CONCAT2(a, b)
+#define CAM_PROFILE_ZONE(name) ::cam::profile::ScopedZone CAM_PROFILE_CONCAT(camProfileZone, __LINE__){name}
+#define CAM_PROFILE_COUNT(name, n) ::cam::profile::count(name, n)
+
+#else
+
+#define CAM_PROFILE_ZONE(name) do {} while (false)
+#define CAM_PROFILE_COUNT(name, n) do {} while (false)
+
+#endif
@@ -18,6 +18,7 @@
 #define _USE_MATH_DEFINES
 
 #include "cam.h"
+#include "geometry.h"
 #include "offset.h"
 
 using namespace cam;
@@ -47,99 +48,158 @@ struct SetIsOverTab {
     }
 };
 
-extern "C" void separateTabs(
-    double** pathPolygons, int numPaths, int* pathSizes,
-    double** tabPolygons, int numTabPolygons, int* tabPolygonSizes,
-    int& error,
-    double**& resultPaths, int& resultNumPaths, int*& resultPathSizes)
+static PolygonSet separateTabPaths(const PolygonSet& paths, const PolygonSet& tabs, const EdgeBvh<Point>& tabEdges, bool& error)
 {
-    try {
-        using Edge = Edge<Point, EdgeNext, TabsEdge>;
-        using ScanlineEdge = ScanlineEdge<Edge, ScanlineEdgeWindingNumber>;
-        using Scan = Scan<ScanlineEdge>;
-
-        //printf("separateTabs\n");
-
-        PolygonSet paths = convertPathsFromC(pathPolygons, numPaths, pathSizes);
-        PolygonSet tabs = convertPathsFromC(tabPolygons, numTabPolygons, tabPolygonSizes);
-        error = false;
-
-        if (paths.empty() || tabs.empty()) {
-            convertPathsToC(resultPaths, resultNumPaths, resultPathSizes, paths);
-            return;
+    using Edge = Edge<Point, EdgeNext, TabsEdge>;
+    using ScanlineEdge = ScanlineEdge<Edge, ScanlineEdgeWindingNumber>;
+    using Scan = Scan<ScanlineEdge>;
+
+    //printf("separateTabs\n");
+    CAM_PROFILE_ZONE("separateTabs");
+    error = false;
+
+    if (paths.empty() || tabs.empty())
+        return paths;
+
+    //for (size_t i = 0; i < paths.size(); ++i)
+    //    printf("%d: %d\n", i, paths[i].size());
+
+    ArenaVector<Edge> cutEdges;
+    Scan::insertPolygons(cutEdges, paths.begin(), paths.end(), false);
+    //printf("cut size: %d\n", cutEdges.size());
+
+    // Only cut edges near a tab edge can cross into or out of a tab; the rest are wholly
+    // over a tab or wholly off one, and skip the scan. Near is a bounding box test with a
+    // unit of slack, so edges which snap to a tab edge's pixels still get split.
+    ArenaVector<Edge> edges;
+    ArenaVector<Edge> farEdges;
+    for (size_t i = 0; i < cutEdges.size(); ++i) {
+        auto& e = cutEdges[i];
+        e.isCutPath = true;
+        e.index = i;
+        Point low{min(x(e.point1), x(e.point2)) - 1, min(y(e.point1), y(e.point2)) - 1};
+        Point high{max(x(e.point1), x(e.point2)) + 1, max(y(e.point1), y(e.point2)) + 1};
+        if (tabEdges.forEachInBox(low, high, [](size_t){return true; }))
+            edges.push_back(e);
+        else {
+            e.isOverTab = tabEdges.contains(e.point1);
+            farEdges.push_back(e);
         }
-
-        //for (size_t i = 0; i < paths.size(); ++i)
-        //    printf("%d: %d\n", i, paths[i].size());
-
-        std::vector<Edge> edges;
-        Scan::insertPolygons(edges, paths.begin(), paths.end(), false);
-        for (auto& e: edges)
-            e.isCutPath = true;
-        //printf("cut size: %d\n", edges.size());
-        Scan::insertPolygons(edges, tabs.begin(), tabs.end(), true);
-        for (size_t i = 0; i < edges.size(); ++i)
-            edges[i].index = i;
-
-        Scan::intersectEdges(edges, edges.begin(), edges.end());
-        Scan::sortEdges(edges.begin(), edges.end());
-        Scan::scan(
-            edges.begin(), edges.end(),
-            makeAccumulateWindingNumber([](ScanlineEdge& e){return !e.edge->isCutPath; }),
-            SetIsOverTab{});
-
-        sort(edges.begin(), edges.end(), [](const Edge& a, const Edge& b){
-            return combineLess(
-                a, b,
-                [](const Edge& a, const Edge& b){return (!a.isCutPath) < (!b.isCutPath); },
-                [](const Edge& a, const Edge& b){return a.index < b.index; });
-        });
-        for (auto& edge: edges)
-            if (swapped(edge))
-                swap(edge.point1, edge.point2);
-
-        PolygonSet result{{}};
-        bool isOverTab = false;
-        Point currentPoint = paths[0][0];
-        auto pos = edges.begin();
-        while (pos != edges.end()) {
-            if (!pos->isCutPath)
-                break;
-            auto e = pos;
-            while (e != edges.end() && e->isCutPath && e->index == pos->index)
-                ++e;
-            bool found = false;
-            for (auto p = pos; p != e; ++p) {
-                if (!p->taken && p->point1 == currentPoint) {
-                    if (p->isOverTab != isOverTab) {
-                        if (!result.back().empty())
-                            result.back().emplace_back(currentPoint);
-                        result.emplace_back();
-                        isOverTab = p->isOverTab;
-                    }
-                    result.back().emplace_back(currentPoint);
-                    currentPoint = p->point2;
-                    p->taken = true;
-                    found = true;
-                    break;
+    }
+    size_t tabsBegin = edges.size();
+    Scan::insertPolygons(edges, tabs.begin(), tabs.end(), true);
+    for (size_t i = tabsBegin; i < edges.size(); ++i)
+        edges[i].index = cutEdges.size() + i - tabsBegin;
+    CAM_PROFILE_COUNT("separateTabs.farEdges", farEdges.size());
+
+    Scan::intersectEdges(edges, edges.begin(), edges.end());
+    Scan::sortEdges(edges.begin(), edges.end());
+    Scan::scan(
+        edges.begin(), edges.end(),
+        makeAccumulateWindingNumber([](ScanlineEdge& e){return !e.edge->isCutPath; }),
+        SetIsOverTab{});
+    edges.insert(edges.end(), farEdges.begin(), farEdges.end());
+
+    sort(edges.begin(), edges.end(), [](const Edge& a, const Edge& b){
+        return combineLess(
+            a, b,
+            [](const Edge& a, const Edge& b){return (!a.isCutPath) < (!b.isCutPath); },
+            [](const Edge& a, const Edge& b){return a.index < b.index; });
+    });
+    for (auto& edge: edges)
+        if (swapped(edge))
+            swap(edge.point1, edge.point2);
+
+    PolygonSet result{{}};
+    bool isOverTab = false;
+    Point currentPoint = paths[0][0];
+    auto pos = edges.begin();
+    while (pos != edges.end()) {
+        if (!pos->isCutPath)
+            break;
+        auto e = pos;
+        while (e != edges.end() && e->isCutPath && e->index == pos->index)
+            ++e;
+        bool found = false;
+        for (auto p = pos; p != e; ++p) {
+            if (!p->taken && p->point1 == currentPoint) {
+                if (p->isOverTab != isOverTab) {
+                    if (!result.back().empty())
+                        result.back().emplace_back(currentPoint);
+                    result.emplace_back();
+                    isOverTab = p->isOverTab;
                 }
+                result.back().emplace_back(currentPoint);
+                currentPoint = p->point2;
+                p->taken = true;
+                found = true;
+                break;
             }
-            if (!found) {
-                error = true;
-                convertPathsToC(resultPaths, resultNumPaths, resultPathSizes, paths);
-                return;
-            }
-            bool allTaken = true;
-            for (auto p = pos; p != e; ++p)
-                if (!p->taken)
-                    allTaken = false;
-            if (allTaken)
-                pos = e;
         }
-        result.back().emplace_back(currentPoint);
+        if (!found) {
+            error = true;
+            return paths;
+        }
+        bool allTaken = true;
+        for (auto p = pos; p != e; ++p)
+            if (!p->taken)
+                allTaken = false;
+        if (allTaken)
+            pos = e;
+    }
+    result.back().emplace_back(currentPoint);
 
-        //printf("separateTabs: %d\n", result.size());
-        convertPathsToC(resultPaths, resultNumPaths, resultPathSizes, result);
+    //printf("separateTabs: %d\n", result.size());
+    return result;
+}
+
+PolygonSet cam::separateTabPaths(const PolygonSet& paths, const PolygonSet& tabs, bool& error)
+{
+    return ::separateTabPaths(paths, tabs, EdgeBvh<Point>(tabs), error);
+}
+
+PolygonSet cam::separateTabPaths(const PolygonSet& paths, Geometry& tabs, bool& error)
+{
+    return ::separateTabPaths(paths, tabs.paths(), tabs.edges(), error);
+}
+
+extern "C" void separateTabs(
+    const int* pathPolygons, const int* tabPolygons,
+    int& error,
+    int*& resultPaths)
+{
+    resultPaths = nullptr;
+    try {
+        ArenaScope arena;
+        bool tabError = false;
+        PolygonSet result = separateTabPaths(convertPathsFromFlat(pathPolygons), convertPathsFromFlat(tabPolygons), tabError);
+        error = tabError;
+        resultPaths = convertPathsToFlat(result);
+    }
+    catch (exception& e) {
+        printf("%s\n", e.what());
+    }
+    catch (...) {
+        printf("???? unknown exception\n");
+    }
+};
+
+extern "C" void separateTabsGeometry(
+    const int* pathPolygons, int tabGeometry,
+    int& error,
+    int*& resultPaths)
+{
+    resultPaths = nullptr;
+    error = true;
+    try {
+        Geometry* tabs = findGeometry(tabGeometry);
+        if (!tabs)
+            return;
+        ArenaScope arena;
+        bool tabError = false;
+        PolygonSet result = separateTabPaths(convertPathsFromFlat(pathPolygons), *tabs, tabError);
+        error = tabError;
+        resultPaths = convertPathsToFlat(result);
     }
     catch (exception& e) {
         printf("%s\n", e.what());
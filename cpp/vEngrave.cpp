@@ -16,6 +16,7 @@
 // along with jscut.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "cam.h"
+#include "geometry.h"
 #include "offset.h"
 #include <boost/polygon/voronoi.hpp>
 
@@ -23,6 +24,9 @@ using namespace FlexScan;
 using namespace cam;
 using namespace std;
 
+// Most a toolpath may stray from the curves it follows, in XY and in Z
+static const long long vCarveTolerance = inchToClipperScale / 1000;
+
 template<typename Derived>
 struct VoronoiEdge {
     struct Index {
@@ -50,12 +54,9 @@ struct VoronoiEdge {
         }
     };
 
-    bool isGeometry = false;
-    bool isInGeometry = false;
     bool taken = false;
     Index* index1 = nullptr;
     Index* index2 = nullptr;
-    size_t sourceIndex = 0;
 
     void setTaken() {
         taken = true;
@@ -64,17 +65,6 @@ struct VoronoiEdge {
     }
 };
 
-struct SetIsInGeometry {
-    template<typename Unit, typename HighPrecision, typename It>
-    void operator()(Unit x, HighPrecision y, It begin, It end) const
-    {
-        while (begin != end) {
-            begin->edge->isInGeometry = begin->windingNumberBefore && begin->windingNumberAfter;
-            ++begin;
-        }
-    }
-};
-
 template<typename F>
 void getCorner(const Segment& s1, const Segment& s2, F f)
 {
@@ -119,65 +109,255 @@ static double dist(Point p, const Segment& s)
 
 // Linearize the parabola which is equidistant from p and s. The parabola's
 // endpoints are begin, end.
+//
+// A point's Z follows its distance v from s's line, and v is quadratic along s:
+// v = (u*u + d*d) / (2*d), where d is p's distance from the line. A chord spanning
+// du along s strays du*du / (8*d) from the curve in v no matter where it is, so
+// evenly spaced points need the fewest chords. XY strays no more than v; Z strays
+// v / tan(angle/2).
 template<typename Edge>
-void linearizeParabola(vector<Edge>& edges, Point p, Segment s, PointWithZ begin, PointWithZ end, double angle)
+void linearizeParabola(ArenaVector<Edge>& edges, Point p, Segment s, PointWithZ begin, PointWithZ end, double angle, double tolerance)
 {
     PointWithZ p1 = low(s);
     PointWithZ p2 = high(s);
     int deltaX = x(p2) - x(p1);
     int deltaY = y(p2) - y(p1);
 
-    //printf("curve\n");
-
-    size_t numSegments = 20;
     auto tbegin = projectionRatio(p1, p2, begin);
     auto tend = projectionRatio(p1, p2, end);
 
-    bool done = false;
-    while (!done) {
-        done = true;
-        PointWithZ lastPoint = begin;
-        for (size_t i = 0; i <= numSegments; ++i) {
-            double t = tbegin + (tend-tbegin)*i/numSegments;
+    double d = max(1.0, dist(p, s));
+    double vTolerance = tolerance * min(1.0, tan(angle/2));
+    double along = fabs(tend - tbegin) * len(p2 - p1);
+    size_t numSegments = max(1.0, ceil(along / sqrt(8 * d * vTolerance)));
+    CAM_PROFILE_COUNT("vPocket.parabolaSegments", numSegments);
 
-            // {xt, yt} traces s
-            int xt = x(p1) + lround(deltaX * t);
-            int yt = y(p1) + lround(deltaY * t);
+    PointWithZ lastPoint = begin;
+    for (size_t i = 0; i <= numSegments; ++i) {
+        double t = tbegin + (tend-tbegin)*i/numSegments;
 
-            // {ax, ay} is p relative to {xt, yt}
-            int ax = x(p) - xt;
-            int ay = y(p) - yt;
+        // {xt, yt} traces s
+        int xt = x(p1) + lround(deltaX * t);
+        int yt = y(p1) + lround(deltaY * t);
 
-            double aLengthSquare = (double)ax*ax + (double)ay*ay;
-            double denom = 2*((double)ax*deltaY - (double)ay*deltaX);
+        // {ax, ay} is p relative to {xt, yt}
+        int ax = x(p) - xt;
+        int ay = y(p) - yt;
 
-            int thisX = xt + lround((double)deltaY * aLengthSquare / denom);
-            int thisY = yt - lround((double)deltaX * aLengthSquare / denom);
+        double aLengthSquare = (double)ax*ax + (double)ay*ay;
+        double denom = 2*((double)ax*deltaY - (double)ay*deltaX);
 
-            if (i == numSegments) {
-                thisX = end.x;
-                thisY = end.y;
-            }
+        int thisX = xt + lround((double)deltaY * aLengthSquare / denom);
+        int thisY = yt - lround((double)deltaX * aLengthSquare / denom);
 
-            int thisZ = -lround(len(Point{thisX, thisY} - p) / tan(angle/2));
+        if (i == numSegments) {
+            thisX = end.x;
+            thisY = end.y;
+        }
 
-            if (i == 0)
-                lastPoint.z = thisZ;
-            else {
-                edges.emplace_back(lastPoint, PointWithZ{thisX, thisY, thisZ}, true);
-                lastPoint = PointWithZ{thisX, thisY, thisZ};
-            }
+        int thisZ = -lround(len(Point{thisX, thisY} - p) / tan(angle/2));
+
+        if (i == 0)
+            lastPoint.z = thisZ;
+        else {
+            edges.emplace_back(lastPoint, PointWithZ{thisX, thisY, thisZ}, true);
+            lastPoint = PointWithZ{thisX, thisY, thisZ};
         }
     }
 } // linearizeParabola
 
-template<typename ScanlineEdge>
-vector<typename ScanlineEdge::Edge> getVoronoiEdges(int debugArg0, int debugArg1, PolygonSet& geometry, double angle)
+// Append to ts the split points in (ta, tb] for a line whose distance from a point is
+// sqrt(u*u + h*h), u = u1 + t*length. A chord strays most from that curve where the
+// curve's slope matches the chord's; split until that's within tolerance.
+static void splitCone(ArenaVector<double>& ts, double h, double u1, double length, double ta, double tb, double tolerance)
+{
+    auto f = [h](double u) { return sqrt(u*u + h*h); };
+    double ua = u1 + ta*length, ub = u1 + tb*length;
+    double m = (f(ub) - f(ua)) / (ub - ua);
+    double error = 0;
+    if (m*m < 1) {
+        double u = min(max(m * h / sqrt(1 - m*m), min(ua, ub)), max(ua, ub));
+        error = f(ua) + m * (u - ua) - f(u);
+    }
+    if (error > tolerance && (tb - ta) * length > 1) {
+        splitCone(ts, h, u1, length, ta, (ta + tb) / 2, tolerance);
+        splitCone(ts, h, u1, length, (ta + tb) / 2, tb, tolerance);
+    }
+    else
+        ts.push_back(tb);
+}
+
+// Linearize the straight edge p1-p2 whose Z follows the distance from ref. Points go
+// where Z would otherwise stray more than tolerance from the chords.
+template<typename Edge>
+void linearizeCone(ArenaVector<Edge>& edges, PointWithZ ref, Point p1, Point p2, double angle, double tolerance)
+{
+    double length = euclidean_distance(p1, p2);
+    if (length == 0)
+        return;
+    double dx = (x(p2) - x(p1)) / length, dy = (y(p2) - y(p1)) / length;
+    double rx = x(p1) - x(ref), ry = y(p1) - y(ref);
+    double u1 = rx*dx + ry*dy;
+    double h = fabs(rx*dy - ry*dx);
+
+    ArenaVector<double> ts{0.0};
+    splitCone(ts, h, u1, length, 0, 1, tolerance * tan(angle/2));
+    CAM_PROFILE_COUNT("vPocket.coneSegments", ts.size() - 1);
+
+    PointWithZ lastPoint;
+    for (size_t i = 0; i < ts.size(); ++i) {
+        PointWithZ p{
+            int(lround(x(p1) + ts[i] * (x(p2) - x(p1)))),
+            int(lround(y(p1) + ts[i] * (y(p2) - y(p1))))};
+        p.z = -lround(len(p - ref) / tan(angle/2));
+        if (i)
+            edges.emplace_back(lastPoint, p, true);
+        lastPoint = p;
+    }
+} // linearizeCone
+
+// Fill part.insideEdges, part.edgeInside and part.insideIsLeft. Voronoi edges only meet
+// the boundary at polygon vertices, so each lies wholly inside or outside, except for a
+// secondary edge through a vertex between collinear segments. An edge next to a segment's
+// cell is on the segment's left or right; that and the polygons' orientation decide it.
+// The rest (between two vertices' cells) take the side of an edge they share a Voronoi
+// vertex with, as long as the Voronoi vertex isn't on the boundary. Infinite edges are
+// outside.
+static void classifyVoronoiEdges(const PolygonSet& geometry, MedialAxisPart& part)
 {
-    using Edge = typename ScanlineEdge::Edge;
-    using Scan = Scan<ScanlineEdge>;
+    CAM_PROFILE_ZONE("voronoi classify");
+    auto& segments = part.segments;
+    auto& vd = part.diagram;
+    if (vd.edges().empty())
+        return;
 
-    vector<Segment> segments;
+    // The lowest, leftmost vertex is on an outer boundary; the inside is on the left of
+    // segments if that boundary runs counterclockwise
+    const Polygon* outer = nullptr;
+    Point lowest;
+    for (auto& poly: geometry) {
+        for (auto& p: poly) {
+            if (!outer || y(p) < y(lowest) || y(p) == y(lowest) && x(p) < x(lowest)) {
+                outer = &poly;
+                lowest = p;
+            }
+        }
+    }
+    double area = 0;
+    for (size_t i = 0; i < outer->size(); ++i) {
+        auto& p1 = (*outer)[i];
+        auto& p2 = (*outer)[i + 1 < outer->size() ? i + 1 : 0];
+        area += (double)x(p1) * y(p2) - (double)x(p2) * y(p1);
+    }
+    bool insideIsLeft = area > 0;
+    part.insideIsLeft = insideIsLeft;
+
+    // A straddling edge runs through a vertex where two segments meet in a line
+    enum: unsigned char {unknown, inside, outside, straddling};
+    vector<unsigned char> side(vd.edges().size(), unknown);
+    auto indexOf = [&vd](const bp::voronoi_edge<double>* edge) {
+        return size_t(edge - &vd.edges()[0]);
+    };
+    auto setSide = [&](const bp::voronoi_edge<double>* edge, unsigned char s) {
+        side[indexOf(edge)] = s;
+        side[indexOf(edge->twin())] = s;
+    };
+
+    vector<size_t> queue;
+    for (size_t i = 0; i < vd.edges().size(); i += 2) {
+        auto& edge = vd.edges()[i];
+        auto cell = edge.cell()->contains_segment() ? edge.cell() : edge.twin()->cell();
+        if (!cell->contains_segment()) {
+            if (edge.is_infinite()) {
+                setSide(&edge, outside);
+                queue.push_back(i);
+            }
+            continue;
+        }
+
+        // The chord's midpoint is on the edge's side; parabolic edges don't cross their
+        // segment's line either. A secondary edge may, at a vertex whose segments are
+        // collinear, or run out through a vertex to infinity; it's on both sides, and
+        // doesn't pass its side on.
+        auto& segment = segments[cell->source_index()];
+        auto cross = [&segment](const bp::voronoi_vertex<double>* vertex) {
+            return
+                ((double)x(high(segment)) - x(low(segment))) * (vertex->y() - y(low(segment))) -
+                ((double)y(high(segment)) - y(low(segment))) * (vertex->x() - x(low(segment)));
+        };
+        double length = euclidean_distance(low(segment), high(segment));
+        if (edge.is_infinite()) {
+            auto vertex = edge.vertex0() ? edge.vertex0() : edge.vertex1();
+            double c = vertex ? cross(vertex) : 0;
+            bool straddles = edge.is_secondary() && fabs(c) > length && (c > 0) == insideIsLeft;
+            setSide(&edge, straddles ? straddling : outside);
+            if (!straddles)
+                queue.push_back(i);
+            continue;
+        }
+        double c0 = cross(edge.vertex0());
+        double c1 = cross(edge.vertex1());
+        if (edge.is_secondary() && (c0 > length && c1 < -length || c0 < -length && c1 > length)) {
+            setSide(&edge, straddling);
+            continue;
+        }
+        double c = (c0 + c1) / 2;
+        if (c == 0)
+            continue;
+        setSide(&edge, (c > 0) == insideIsLeft ? inside : outside);
+        queue.push_back(i);
+    }
+
+    // A Voronoi vertex on the boundary is at a polygon vertex: one of its cells' points
+    auto onBoundary = [&segments](const bp::voronoi_vertex<double>* vertex) {
+        auto edge = vertex->incident_edge();
+        do {
+            auto cell = edge->cell();
+            if (cell->contains_point()) {
+                auto& segment = segments[cell->source_index()];
+                Point p = cell->source_category() == bp::SOURCE_CATEGORY_SEGMENT_START_POINT ? low(segment) : high(segment);
+                if (fabs(vertex->x() - x(p)) < 1 && fabs(vertex->y() - y(p)) < 1)
+                    return true;
+            }
+            edge = edge->rot_next();
+        } while (edge != vertex->incident_edge());
+        return false;
+    };
+
+    for (size_t q = 0; q < queue.size(); ++q) {
+        auto& edge = vd.edges()[queue[q]];
+        for (auto vertex: {edge.vertex0(), edge.vertex1()}) {
+            if (!vertex || onBoundary(vertex))
+                continue;
+            auto other = vertex->incident_edge();
+            do {
+                if (side[indexOf(other)] == unknown) {
+                    setSide(other, side[queue[q]]);
+                    queue.push_back(indexOf(other) & ~size_t(1));
+                }
+                other = other->rot_next();
+            } while (other != vertex->incident_edge());
+        }
+    }
+
+    part.edgeInside.resize(vd.edges().size());
+    for (size_t i = 0; i < vd.edges().size(); i += 2) {
+        auto& edge = vd.edges()[i];
+        if (side[i] == unknown)
+            CAM_PROFILE_COUNT("voronoi.unclassified", 1);
+        part.edgeInside[i] = part.edgeInside[i + 1] = side[i] == inside || side[i] == straddling;
+        if (!edge.is_primary() || !edge.is_finite() || side[i] != inside)
+            continue;
+        // Drop edges which round to a point
+        if (lround(edge.vertex0()->x()) != lround(edge.vertex1()->x()) || lround(edge.vertex0()->y()) != lround(edge.vertex1()->y()))
+            part.insideEdges.push_back(i);
+    }
+} // classifyVoronoiEdges
+
+// Voronoi diagram of one group's segments and which of its edges are inside
+static void buildMedialAxisPart(const PolygonSet& geometry, MedialAxisPart& result)
+{
+    auto& segments = result.segments;
     for (auto& poly: geometry) {
         for (size_t i = 0; i < poly.size(); ++i) {
             if (i+1 < poly.size())
@@ -187,61 +367,131 @@ vector<typename ScanlineEdge::Edge> getVoronoiEdges(int debugArg0, int debugArg1
         }
     }
 
-    printf("b\n");
-    bp::voronoi_diagram<double> vd;
+    CAM_PROFILE_ZONE("buildMedialAxisPart");
+    CAM_PROFILE_COUNT("voronoi.segments", segments.size());
+    auto& vd = result.diagram;
     bp::default_voronoi_builder builder;
     for (auto& segment: segments)
         builder.insert_segment(x(low(segment)), y(low(segment)), x(high(segment)), y(high(segment)));
-    printf("c\n");
-    builder.construct(&vd);
+    {
+        CAM_PROFILE_ZONE("voronoi construct");
+        builder.construct(&vd);
+    }
+    CAM_PROFILE_COUNT("voronoi.edges", vd.edges().size());
 
-    vector<Edge> filterEdges;
-    printf("d\n");
-    Scan::insertPolygons(filterEdges, geometry.begin(), geometry.end(), true);
-    printf("e\n");
-    for (size_t i = 0; i < filterEdges.size(); ++i)
-        filterEdges[i].isGeometry = true;
+    classifyVoronoiEdges(geometry, result);
+} // buildMedialAxisPart
 
-    for (auto& edge: vd.edges())
-        edge.color(0);
-    printf("f: %d voronoi edges\n", vd.edges().size());
+// Number each polygon's group (see MedialAxis): polygons whose bounding boxes overlap or touch,
+// directly or through others, share a group. Groups are numbered in order of their first
+// polygon.
+static vector<size_t> groupPolygons(const PolygonSet& geometry, size_t& numGroups)
+{
+    struct Box {
+        int minX = numeric_limits<int>::max(), minY = numeric_limits<int>::max();
+        int maxX = numeric_limits<int>::min(), maxY = numeric_limits<int>::min();
+    };
+    vector<Box> boxes(geometry.size());
+    for (size_t i = 0; i < geometry.size(); ++i) {
+        for (auto& p: geometry[i]) {
+            boxes[i].minX = min(boxes[i].minX, x(p));
+            boxes[i].minY = min(boxes[i].minY, y(p));
+            boxes[i].maxX = max(boxes[i].maxX, x(p));
+            boxes[i].maxY = max(boxes[i].maxY, y(p));
+        }
+    }
 
-    for (size_t i = 0; i < vd.edges().size(); ++i) {
-        auto& edge = vd.edges()[i];
-        if (edge.is_primary() && edge.is_finite() && !(edge.color()&1)) {
-            edge.color(1);
-            edge.twin()->color(1);
-            Point p1{lround(edge.vertex0()->x()), lround(edge.vertex0()->y())};
-            Point p2{lround(edge.vertex1()->x()), lround(edge.vertex1()->y())};
-            filterEdges.emplace_back(p1, p2, true);
-            filterEdges.back().sourceIndex = i;
+    vector<size_t> parent(geometry.size());
+    for (size_t i = 0; i < parent.size(); ++i)
+        parent[i] = i;
+    auto find = [&parent](size_t i) {
+        while (parent[i] != i)
+            i = parent[i] = parent[parent[i]];
+        return i;
+    };
+
+    // Sweep in x; active holds the boxes which may still reach the current one
+    vector<size_t> order(geometry.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    sort(order.begin(), order.end(), [&boxes](size_t a, size_t b) { return boxes[a].minX < boxes[b].minX; });
+    vector<size_t> active;
+    for (auto i: order) {
+        auto& box = boxes[i];
+        size_t numActive = 0;
+        for (auto j: active) {
+            auto& other = boxes[j];
+            if (other.maxX < box.minX)
+                continue;
+            active[numActive++] = j;
+            if (other.minY <= box.maxY && box.minY <= other.maxY) {
+                size_t a = find(i), b = find(j);
+                parent[max(a, b)] = min(a, b);
+            }
         }
+        active.resize(numActive);
+        active.push_back(i);
     }
 
-    printf("g1: %d filterEdges\n", filterEdges.size());
-    Scan::intersectEdges(filterEdges, filterEdges.begin(), filterEdges.end());
-    printf("g2: %d filterEdges\n", filterEdges.size());
-    Scan::sortEdges(filterEdges.begin(), filterEdges.end());
-    printf("g3: %d filterEdges\n", filterEdges.size());
-    Scan::scan(
-        filterEdges.begin(), filterEdges.end(),
-        makeAccumulateWindingNumber([](ScanlineEdge& e){return e.edge->isGeometry; }),
-        SetIsInGeometry{});
-    printf("g4\n");
-
-    vector<Edge> edges;
-    for (auto& e: filterEdges) {
-        if (e.isGeometry || !e.isInGeometry)
-            continue;
+    // Each root is its group's first polygon
+    vector<size_t> groups(geometry.size());
+    vector<size_t> rootGroup(geometry.size(), numeric_limits<size_t>::max());
+    numGroups = 0;
+    for (size_t i = 0; i < geometry.size(); ++i) {
+        size_t root = find(i);
+        if (rootGroup[root] == numeric_limits<size_t>::max())
+            rootGroup[root] = numGroups++;
+        groups[i] = rootGroup[root];
+    }
+    return groups;
+}
+
+void cam::buildMedialAxis(const PolygonSet& geometry, MedialAxis& result, const ExecutionPolicy& policy)
+{
+    CAM_PROFILE_ZONE("buildMedialAxis");
+    size_t numGroups;
+    auto groups = groupPolygons(geometry, numGroups);
+    CAM_PROFILE_COUNT("voronoi.groups", numGroups);
+    result.parts = vector<MedialAxisPart>(numGroups);
+    if (numGroups == 1) {
+        buildMedialAxisPart(geometry, result.parts[0]);
+        return;
+    }
+
+    vector<PolygonSet> groupGeometry(numGroups);
+    vector<size_t> groupSize(numGroups);
+    for (size_t i = 0; i < geometry.size(); ++i) {
+        groupGeometry[groups[i]].push_back(geometry[i]);
+        groupSize[groups[i]] += geometry[i].size();
+    }
+
+    // Largest first, so a big group doesn't start last and hold up the rest
+    vector<size_t> order(numGroups);
+    for (size_t i = 0; i < numGroups; ++i)
+        order[i] = i;
+    if (policy.parallel())
+        stable_sort(order.begin(), order.end(), [&groupSize](size_t a, size_t b) { return groupSize[a] > groupSize[b]; });
+    parallelFor(policy, numGroups, [&](size_t i) {
+        buildMedialAxisPart(groupGeometry[order[i]], result.parts[order[i]]);
+    });
+} // buildMedialAxis
+
+// Append part's toolpath edges to edges
+template<typename Edge>
+void getVoronoiEdges(int debugArg0, int debugArg1, ArenaVector<Edge>& edges, const MedialAxisPart& part, double angle, double tolerance)
+{
+    auto& segments = part.segments;
+    auto& vd = part.diagram;
 
-        auto& edge = vd.edges()[e.sourceIndex];
+    for (auto sourceIndex: part.insideEdges) {
+        auto& edge = vd.edges()[sourceIndex];
 
         //if (debugArg0 && edges.size() == (size_t)debugArg0)
         //    break;
         auto cell = edge.cell();
         auto twinCell = edge.twin()->cell();
-        Point p1{lround(edge.vertex0()->x()), lround(edge.vertex0()->y())};
-        Point p2{lround(edge.vertex1()->x()), lround(edge.vertex1()->y())};
+        Point p1{int(lround(edge.vertex0()->x())), int(lround(edge.vertex0()->y()))};
+        Point p2{int(lround(edge.vertex1()->x())), int(lround(edge.vertex1()->y()))};
 
         if (edge.is_linear()) {
             auto segment1 = segments[cell->source_index()];
@@ -261,18 +511,7 @@ vector<typename ScanlineEdge::Edge> getVoronoiEdges(int debugArg0, int debugArg1
                     ref = low(segments[cell->source_index()]);
                 else
                     ref = high(segments[cell->source_index()]);
-                int numSegments = 20;
-                PointWithZ lastPoint;
-                for (int i = 0; i <= numSegments; ++i) {
-                    PointWithZ p{
-                        lround(x(p1) + (double)i * (x(p2) - x(p1)) / numSegments),
-                        lround(y(p1) + (double)i * (y(p2) - y(p1)) / numSegments)};
-                    p.z = -lround(len(p - ref) / tan(angle/2));
-                    //printf("zzz0: %d, %d, i: %d, p:(%d, %d), p1: (%d, %d), p2: (%d, %d), ref:(%d, %d)\n", lastPoint.z, p.z, i, x(p), y(p), x(p1), y(p1), x(p2), y(p2), x(ref), y(ref));
-                    if (i)
-                        edges.emplace_back(lastPoint, p, true);
-                    lastPoint = p;
-                }
+                linearizeCone(edges, ref, p1, p2, angle, tolerance);
             }
             else
             {
@@ -304,18 +543,38 @@ vector<typename ScanlineEdge::Edge> getVoronoiEdges(int debugArg0, int debugArg1
                 segment = segments[cell->source_index()];
             }
 
-            linearizeParabola(edges, point, segment, p1, p2, angle);
+            linearizeParabola(edges, point, segment, p1, p2, angle, tolerance);
         }
     }
+} // getVoronoiEdges
 
-    printf("g5: %d edges\n", edges.size());
+// Toolpath edges along the medial axis, with Z for a V cutter of angle
+template<typename Edge>
+ArenaVector<Edge> getVoronoiEdges(int debugArg0, int debugArg1, const MedialAxis& medialAxis, double angle, double tolerance)
+{
+    CAM_PROFILE_ZONE("getVoronoiEdges");
+    ArenaVector<Edge> edges;
+    for (auto& part: medialAxis.parts)
+        getVoronoiEdges(debugArg0, debugArg1, edges, part, angle, tolerance);
+
+    CAM_PROFILE_COUNT("voronoi.toolpathEdges", edges.size());
     return edges;
 } // getVoronoiEdges
 
+// Feed edges to callback in cutting order. callback(edge, isLast) returns where the
+// cutter ends up.
+//
+// Edges form a graph whose vertices are the distinct XY ends; edgeIndexes, sorted by XY,
+// holds each vertex's edges together. From where the cutter is, prefer an untaken edge
+// at the same XY and level (both at the surface, or both below it), then one which stays
+// at that level, then the nearest Z. Failing that, rapid to the nearest end at the
+// surface, or if none are left, the nearest end below it. Those come from k-d trees of
+// the untaken ends, so ordering stays O(n log n) however the edges are scattered.
 template<typename Edge, typename Callback>
-void reorderEdges(int debugArg0, int debugArg1, vector<Edge>& edges, Callback callback) {
-    printf("i\n");
-    vector<typename Edge::Index> edgeIndexes;
+void reorderEdges(int debugArg0, int debugArg1, ArenaVector<Edge>& edges, Callback callback) {
+    CAM_PROFILE_ZONE("reorderEdges");
+    using Index = typename Edge::Index;
+    ArenaVector<Index> edgeIndexes;
     edgeIndexes.reserve(edges.size() * 2);
     for (auto& edge: edges) {
         edgeIndexes.emplace_back(edge.point1, edge.point2, false, &edge);
@@ -328,209 +587,440 @@ void reorderEdges(int debugArg0, int debugArg1, vector<Edge>& edges, Callback ca
         else
             edgeIndex.edge->index1 = &edgeIndex;
     }
+    CAM_PROFILE_COUNT("reorderEdges.indexes", edgeIndexes.size());
+
+    // Ends by level: [0] at the surface, [1] below it. treeIndex maps an edgeIndexes
+    // position to its place in its level's tree.
+    ArenaVector<size_t> levelIndexes[2];
+    ArenaVector<size_t> treeIndex(edgeIndexes.size());
+    ArenaVector<Point> levelPoints[2];
+    for (size_t i = 0; i < edgeIndexes.size(); ++i) {
+        int level = edgeIndexes[i].point.z != 0;
+        treeIndex[i] = levelIndexes[level].size();
+        levelIndexes[level].push_back(i);
+        levelPoints[level].emplace_back(edgeIndexes[i].point.x, edgeIndexes[i].point.y);
+    }
+    PointKdTree<Point> levelTrees[2] = {
+        {levelPoints[0].begin(), levelPoints[0].end()},
+        {levelPoints[1].begin(), levelPoints[1].end()},
+    };
+
+    auto take = [&](Index& index) {
+        index.edge->setTaken();
+        for (auto i: {index.edge->index1, index.edge->index2}) {
+            size_t pos = i - &edgeIndexes[0];
+            levelTrees[i->point.z != 0].remove(treeIndex[pos]);
+        }
+        if (index.isPoint2)
+            swap(index.edge->point1, index.edge->point2);
+    };
 
-    printf("j: edgeIndexes: %d\n", edgeIndexes.size());
-    auto start = find_if(edgeIndexes.begin(), edgeIndexes.end(), [](const typename Edge::Index& index){return !index.point.z; });
+    // Start at the surface if any end is there. None is when the medial axis never reaches
+    // the boundary, e.g. the closed loop down the middle of a ring (logo-circle.svg), so
+    // start at the lowest XY end instead; the callback plunges into the first edge wherever
+    // it is, as it does after any rapid to an end below the surface.
+    auto start = find_if(edgeIndexes.begin(), edgeIndexes.end(), [](const Index& index){return !index.point.z; });
     if (start == edgeIndexes.end())
-        start = edgeIndexes.begin(); // !!!!
-    start->edge->setTaken();
-    if (start->isPoint2)
-        swap(start->edge->point1, start->edge->point2);
+        start = edgeIndexes.begin();
+    take(*start);
     PointWithZ p = callback(*start->edge, edges.size() == 1);
     size_t numProcessed = 1;
 
-    auto rank = [&p](const typename Edge::Index& e) {
-        if ((e.point.z == 0) != (p.z == 0) || e.point != p) {
-            if (e.point.z != 0)
-                return 0;
-            else
-                return 1;
-        }
-        if ((e.otherPoint.z == 0) != (p.z == 0))
-            return 2;
-        return 3;
-    };
-
-    printf("k\n");
     while (numProcessed < edges.size()) {
-        //printf("numProcessed: %d/%d\n", numProcessed, edges.size());
-        auto searchStart = lower_bound(edgeIndexes.begin(), edgeIndexes.end(), typename Edge::Index{p});
-        auto closest = edgeIndexes.begin();
+        Index* closest = nullptr;
         int closestRank = 0;
         int closestZdist = numeric_limits<int>::max();
         int closestOtherZdist = numeric_limits<int>::max();
-        double closestDist = numeric_limits<double>::max();
 
-        //if (debugArg0 && numProcessed == (size_t)debugArg0)
-        //    break;
-
-        //if (debugArg1 && numProcessed == (size_t)debugArg1)
-        //    printf("P: %d, %d, %d\n", p.x, p.y, p.z);
-
-        auto setClosest = [&](typename vector<typename Edge::Index>::iterator it) -> bool{
-            if (!it->taken) {
-                int r = rank(*it);
-                int zDist = abs(p.z - it->point.z);
-                int otherZdist = abs(p.z - it->otherPoint.z);
-                double dist = lenSquared(p - it->point);
-
-                if (closestRank >= 1 && abs(it->point.x - p.x) > closestDist)
-                    return false;
-
-                if (r > closestRank || r == closestRank && (
-                    it->point == p && zDist < closestZdist || (it->point != p || zDist == closestZdist) && (
-                    it->point == p && otherZdist < closestOtherZdist || (it->point != p || otherZdist == closestOtherZdist) &&
-                    dist < closestDist))) {
-
-                    //if (debugArg1 && numProcessed == (size_t)debugArg1)
-                    //    printf("  +rank: %d zDist:%d otherZdist:%d dist: %lld (%d, %d, %d) -> (%d, %d, %d)\n", r, zDist, otherZdist, llround(dist), it->point.x, it->point.y, it->point.z, it->otherPoint.x, it->otherPoint.y, it->otherPoint.z);
-                    closest = it;
-                    closestZdist = zDist;
-                    closestOtherZdist = otherZdist;
-                    closestDist = dist;
-                    closestRank = r;
-                }
-                //else if (debugArg1 && numProcessed == (size_t)debugArg1/* && p == it->point)*/)
-                //    printf("  -rank: %d zDist:%d otherZdist:%d dist: %lld (%d, %d, %d) -> (%d, %d, %d)\n", r, zDist, otherZdist, llround(dist), it->point.x, it->point.y, it->point.z, it->otherPoint.x, it->otherPoint.y, it->otherPoint.z);
+        // Edges at p; rank 3 stays at p's level, rank 2 leaves it
+        auto range = equal_range(edgeIndexes.begin(), edgeIndexes.end(), Index{p});
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->taken || (it->point.z == 0) != (p.z == 0))
+                continue;
+            int r = (it->otherPoint.z == 0) != (p.z == 0) ? 2 : 3;
+            int zDist = abs(p.z - it->point.z);
+            int otherZdist = abs(p.z - it->otherPoint.z);
+            if (r > closestRank || r == closestRank && (
+                zDist < closestZdist || zDist == closestZdist && otherZdist < closestOtherZdist)) {
+                closest = &*it;
+                closestRank = r;
+                closestZdist = zDist;
+                closestOtherZdist = otherZdist;
             }
-            return true;
-        };
+        }
 
-        for (auto it2 = searchStart; it2 != edgeIndexes.end(); ++it2)
-            if (!setClosest(it2))
-                break;
-        for (auto it2 = searchStart; it2 != edgeIndexes.begin(); --it2)
-            if (!setClosest(it2 - 1))
-                break;
+        if (!closest) {
+            int level = levelTrees[0].numLeft() ? 0 : 1;
+            double dist2;
+            size_t nearest = levelTrees[level].nearest(p.toPoint(), dist2);
+            closest = &edgeIndexes[levelIndexes[level][nearest]];
+        }
 
         if (p.z == 0 && closest->point.z != 0)
-            printf("dive\n");
+            CAM_PROFILE_COUNT("reorderEdges.dives", 1);
         if (p.z != 0 && closest->point.z == 0)
-            printf("retract\n");
-
-        closest->edge->setTaken();
-        if (closest->isPoint2)
-            swap(closest->edge->point1, closest->edge->point2);
-
-        //if (debugArg1 && numProcessed == (size_t)debugArg1)
-        //    printf("Old P: %d, %d, %d\n", p.x, p.y, p.z);
-
-        //if (debugArg1 && numProcessed == (size_t)debugArg1)
-        //    for (auto& ind: edgeIndexes)
-        //        if (ind.point.x == p.x && ind.point.y == p.y)
-        //            printf("  (%d, %d, %d) -> (%d, %d, %d) taken=%d\n", ind.point.x, ind.point.y, ind.point.z, ind.otherPoint.x, ind.otherPoint.y, ind.otherPoint.z, ind.taken);
+            CAM_PROFILE_COUNT("reorderEdges.retracts", 1);
 
+        take(*closest);
         p = callback(*closest->edge, edges.size() == numProcessed + 1);
         ++numProcessed;
-
-        //if (debugArg1 && numProcessed == (size_t)debugArg1)
-        //    printf("New P: %d, %d, %d\n", p.x, p.y, p.z);
     } // while (numProcessed < edges.size())
 } // reorderEdges
 
-template<typename Edge>
-void clipTopZ(double passDepth, double maxDepth, vector<PointWithZ>& path, const Edge& edge)
+// A run of segments [first, last) over a span's vertices, lifted by lift
+struct SpanPiece {
+    size_t first;
+    size_t last;
+    int lift;
+};
+
+// Where a-b crosses the surface; a is at or above it and b below
+static PointWithZ surfaceCrossing(const PointWithZ& a, const PointWithZ& b)
 {
-    if (path.empty() || path.back() != edge.point1 || path.back().z != edge.point1.z)
-        path.push_back(edge.point1);
-    if (path.empty() || path.back() != edge.point2 || path.back().z != edge.point2.z)
-        path.push_back(edge.point2);
+    double t = double(a.z) / (a.z - b.z);
+    return PointWithZ(
+        int(lround(a.x + (b.x - a.x) * t)), int(lround(a.y + (b.y - a.y) * t)), 0);
+}
+
+// Emit piece to sink, forwards or backwards, entering and leaving at the surface.
+// Returns the last point.
+static PointWithZ emitPiece(PathSink& sink, const ArenaVector<PointWithZ>& vertices, SpanPiece piece, bool reverse)
+{
+    auto lifted = [&](size_t i) {
+        return PointWithZ(vertices[i].x, vertices[i].y, vertices[i].z + piece.lift);
+    };
+
+    // Ends are either at the surface (clipped), or the span's own ends, which get a
+    // plunge or retract
+    size_t from = reverse ? piece.last : piece.first;
+    size_t to = reverse ? piece.first : piece.last;
+    int step = reverse ? -1 : 1;
+
+    PointWithZ begin = lifted(from);
+    if (begin.z >= 0)
+        sink.addPoint(surfaceCrossing(begin, lifted(from + step)));
+    else {
+        sink.addPoint(PointWithZ(begin.x, begin.y, 0));
+        sink.addPoint(begin);
+    }
+    for (size_t i = from + step; i != to; i += step)
+        sink.addPoint(lifted(i));
+    PointWithZ end = lifted(to), result;
+    if (end.z >= 0)
+        result = surfaceCrossing(end, lifted(to - step));
+    else {
+        sink.addPoint(end);
+        result = PointWithZ(end.x, end.y, 0);
+    }
+    sink.addPoint(result);
+    sink.endPath();
+    return result;
 }
 
+// Emit the toolpath for span to sink. Returns the toolpath's last point.
+//
+// The span's vertices are stored once, clamped to maxDepth. Each pass lifts the whole
+// carve, the first so its deepest point is passDepth down and each after that passDepth
+// deeper, until the last isn't lifted. Whatever a lift puts at or above the surface cuts
+// nothing, so a pass is emitted as the pieces between surface crossings: index ranges
+// into the vertices. Passes alternate direction so each starts near where the last
+// ended.
 template<typename Edge>
-void processSpan(double passDepth, double maxDepth, vector<vector<PointWithZ>>& result, vector<Edge>& span)
+PointWithZ processSpan(double passDepth, double maxDepth, PathSink& sink, ArenaVector<Edge>& span)
 {
-    //printf("processSpan\n");
-    //passDepth = min(passDepth, maxDepth);
-    int minZ = 0;
+    ArenaVector<PointWithZ> vertices;
+    vertices.reserve(span.size() + 1);
+    vertices.push_back(span.front().point1);
     for (auto& edge: span)
-        minZ = min(minZ, min(edge.point1.z, edge.point2.z));
-
-    vector<PointWithZ> path;
+        vertices.push_back(edge.point2);
 
-    int deltaZ = max(0.0, -passDepth - minZ);
-    //printf("    span: %d, passDepth: %d, minZ: %d, deltaZ: %d\n", span.size(), (int)passDepth, minZ, deltaZ);
+    int minZ = 0;
+    for (auto& v: vertices) {
+        if (maxDepth > 0)
+            v.z = max(v.z, int(-maxDepth));
+        minZ = min(minZ, v.z);
+    }
 
+    ArenaVector<SpanPiece> pieces;
+    int lift = passDepth > 0 ? max(0.0, -passDepth - minZ) : 0;
     bool reverse = false;
+    PointWithZ result = vertices.back();
+    result.z = 0;
     while (true) {
-        //printf("    span: %d, reverse: %d, deltaZ: %d\n", span.size(), reverse, deltaZ);
-
-        if (reverse) {
-            for (auto it = span.rbegin(); it != span.rend(); ++it)
-            {
-                clipTopZ(passDepth, maxDepth, path, Edge{
-                    PointWithZ{it->point2.x, it->point2.y, it->point2.z + deltaZ},
-                    PointWithZ{it->point1.x, it->point1.y, it->point1.z + deltaZ}, false});
-            }
-        }
-        else {
-            for (auto& edge: span)
-            {
-                clipTopZ(passDepth, maxDepth, path, Edge{
-                    PointWithZ{edge.point1.x, edge.point1.y, edge.point1.z + deltaZ},
-                    PointWithZ{edge.point2.x, edge.point2.y, edge.point2.z + deltaZ}, false});
+        // Split at vertices the lift puts at or above the surface, and drop segments
+        // with both ends there
+        pieces.clear();
+        size_t first = 0;
+        for (size_t i = 1; i < vertices.size(); ++i) {
+            if (i + 1 == vertices.size() || vertices[i].z + lift >= 0) {
+                if (vertices[first].z + lift < 0 || vertices[i].z + lift < 0 || i - first > 1)
+                    pieces.push_back(SpanPiece{first, i, lift});
+                first = i;
             }
         }
 
-        if (deltaZ == 0)
+        if (reverse)
+            for (auto it = pieces.rbegin(); it != pieces.rend(); ++it)
+                result = emitPiece(sink, vertices, *it, true);
+        else
+            for (auto& piece: pieces)
+                result = emitPiece(sink, vertices, piece, false);
+
+        if (lift == 0)
             break;
-        deltaZ = max(0.0, deltaZ - passDepth);
+        lift = max(0.0, lift - passDepth);
         reverse = !reverse;
     }
-
-    if (path.front().z != 0)
-        path.insert(path.begin(), PointWithZ{path.front().x, path.front().y, 0});
-    if (path.back().z != 0)
-        path.insert(path.end(), PointWithZ{path.back().x, path.back().y, 0});
-    result.emplace_back(move(path));
-    //printf("    result: %d\n", result.size());
+    if (pieces.empty())
+        result = PointWithZ((reverse ? vertices.front() : vertices.back()).toPoint());
+    return result;
 }
 
-extern "C" void vPocket(
+// vPocket's work; toolpaths go to sink as they're finished. Returns the depth the carve
+// would reach without maxDepth.
+static double vPocketPaths(
     int debugArg0, int debugArg1,
-    double** paths, int numPaths, int* pathSizes,
+    const MedialAxis& medialAxis,
     double cutterAngle, double passDepth, double maxDepth,
-    double**& resultPaths, int& resultNumPaths, int*& resultPathSizes)
+    PathSink& sink)
 {
-    try {
-        using Edge = Edge<PointWithZ, VoronoiEdge>;
-        using ScanlineEdge = ScanlineEdge<Edge, ScanlineEdgeWindingNumber>;
-        double angle = cutterAngle * M_PI / 180;
+    using Edge = Edge<PointWithZ, VoronoiEdge>;
+    double angle = cutterAngle * M_PI / 180;
+
+    CAM_PROFILE_ZONE("vPocket");
+    ArenaScope arena;
+    auto edges = getVoronoiEdges<Edge>(debugArg0, debugArg1, medialAxis, angle, vCarveTolerance);
+    if (edges.empty())
+        return 0;
+
+    int deepest = 0;
+    for (auto& edge: edges)
+        deepest = min(deepest, min(edge.point1.z, edge.point2.z));
+
+    ArenaVector<Edge> span;
+    PointWithZ lastPoint;
+    reorderEdges(debugArg0, debugArg1, edges, [passDepth, maxDepth, &span, &sink, &lastPoint](Edge& edge, bool isLast) {
+        if (!span.empty() && edge.point1 != span.back().point2) {
+            lastPoint = processSpan(passDepth, maxDepth, sink, span);
+            span.clear();
+        }
 
-        printf("a\n");
-        PolygonSet geometry = convertPathsFromC(paths, numPaths, pathSizes);
+        span.emplace_back(edge);
 
-        auto edges = getVoronoiEdges<ScanlineEdge>(debugArg0, debugArg1, geometry, angle);
+        if (isLast || edge.point2.z == 0) {
+            lastPoint = processSpan(passDepth, maxDepth, sink, span);
+            span.clear();
+        }
 
-        if (edges.empty()) {
-            convertPathsToC(resultPaths, resultNumPaths, resultPathSizes, vector<vector<PointWithZ>>{});
-            return;
+        if (!span.empty())
+            return span.back().point2;
+        else
+            return lastPoint;
+    });
+    return -deepest;
+}
+
+// Floor of a flat-bottom V-carve: the flat cutter clears floorArea (the geometry inset by
+// vPocketFloorInset()) at each pass depth down to maxDepth. The clearing paths are worked
+// out once and repeated at each depth.
+static void vPocketFloorPaths(
+    const PolygonSet& floorArea,
+    double passDepth, double maxDepth,
+    double flatCutterDia, const double* options,
+    PathSink& sink)
+{
+    CAM_PROFILE_ZONE("vPocketFloor");
+    PolygonSet clearing;
+    {
+        PathSink collect([](void* context, const int* paths) {
+            auto& clearing = *static_cast<PolygonSet*>(context);
+            for (auto& path: convertPathsFromFlat(paths))
+                clearing.push_back(move(path));
+        }, &clearing, false);
+        hspocketPaths(floorArea, flatCutterDia, options, collect);
+        collect.flush();
+    }
+
+    double depth = 0;
+    while (depth < maxDepth && !clearing.empty()) {
+        depth = passDepth > 0 ? min(depth + passDepth, maxDepth) : maxDepth;
+        for (auto& path: clearing) {
+            for (auto& point: path)
+                sink.addPoint(PointWithZ(x(point), y(point), int(-depth)));
+            sink.endPath();
         }
+    }
+}
 
-        vector<Edge> span;
-        vector<vector<PointWithZ>> result;
-        reorderEdges(debugArg0, debugArg1, edges, [passDepth, maxDepth, &span, &result](Edge& edge, bool isLast) {
-            if (!span.empty() && edge.point1 != span.back().point2) {
-                processSpan(passDepth, maxDepth, result, span);
-                span.clear();
-            }
+// How far inside the geometry a carve with cutterAngle reaches depth, plus the flat
+// cutter's radius
+static double vPocketFloorInset(double cutterAngle, double depth, double flatCutterDia)
+{
+    return depth * tan(cutterAngle * M_PI / 180 / 2) + flatCutterDia / 2;
+}
 
-            span.emplace_back(edge);
+// Does a carve which would reach deepest without maxDepth leave the flat cutter a floor?
+// Saves tracing the inset when it would come out empty.
+static bool vPocketHasFloor(double cutterAngle, double deepest, double maxDepth, double flatCutterDia)
+{
+    return vPocketFloorInset(cutterAngle, deepest, 0) > vPocketFloorInset(cutterAngle, maxDepth, flatCutterDia);
+}
 
-            if (isLast || edge.point2.z == 0) {
-                processSpan(passDepth, maxDepth, result, span);
-                span.clear();
-            }
+static void vPocketPaths(
+    int debugArg0, int debugArg1,
+    const int* paths,
+    double cutterAngle, double passDepth, double maxDepth,
+    PathSink& sink)
+{
+    MedialAxis medialAxis;
+    {
+        ArenaScope arena;
+        buildMedialAxis(convertPathsFromFlat(paths), medialAxis);
+    }
+    vPocketPaths(debugArg0, debugArg1, medialAxis, cutterAngle, passDepth, maxDepth, sink);
+}
 
-            if (!span.empty())
-                return span.back().point2;
-            else
-                return result.back().back();
-        });
+extern "C" void vPocket(
+    int debugArg0, int debugArg1,
+    const int* paths,
+    double cutterAngle, double passDepth, double maxDepth,
+    int*& resultPaths)
+{
+    resultPaths = nullptr;
+    try {
+        PathSink sink(true);
+        vPocketPaths(debugArg0, debugArg1, paths, cutterAngle, passDepth, maxDepth, sink);
+        resultPaths = sink.release();
+    }
+    catch (exception& e) {
+        printf("%s\n", e.what());
+    }
+    catch (...) {
+        printf("???? unknown exception\n");
+    }
+};
 
-        printf("z - done\n");
-        convertPathsToC(resultPaths, resultNumPaths, resultPathSizes, result);
-        return;
+extern "C" void vPocketFlat(
+    int debugArg0, int debugArg1,
+    const int* paths,
+    double cutterAngle, double passDepth, double maxDepth,
+    double flatCutterDia, const double* options,
+    int*& resultPaths, int*& resultFloorPaths)
+{
+    resultPaths = nullptr;
+    resultFloorPaths = nullptr;
+    try {
+        MedialAxis medialAxis;
+        {
+            ArenaScope arena;
+            buildMedialAxis(convertPathsFromFlat(paths), medialAxis);
+        }
+        PathSink sink(true);
+        double deepest = vPocketPaths(debugArg0, debugArg1, medialAxis, cutterAngle, passDepth, maxDepth, sink);
+        PathSink floorSink(true);
+        if (vPocketHasFloor(cutterAngle, deepest, maxDepth, flatCutterDia))
+            vPocketFloorPaths(
+                medialAxisInset(medialAxis, vPocketFloorInset(cutterAngle, maxDepth, flatCutterDia), arcTolerance),
+                passDepth, maxDepth, flatCutterDia, options, floorSink);
+        unique_ptr<int, void(*)(void*)> floorPaths(floorSink.release(), free);
+        resultPaths = sink.release();
+        resultFloorPaths = floorPaths.release();
+    }
+    catch (exception& e) {
+        printf("%s\n", e.what());
+    }
+    catch (...) {
+        printf("???? unknown exception\n");
+    }
+};
+
+extern "C" void vPocketStream(
+    int debugArg0, int debugArg1,
+    const int* paths,
+    double cutterAngle, double passDepth, double maxDepth,
+    PathsCallback callback, void* context)
+{
+    try {
+        PathSink sink(callback, context, true);
+        vPocketPaths(debugArg0, debugArg1, paths, cutterAngle, passDepth, maxDepth, sink);
+        sink.flush();
+    }
+    catch (exception& e) {
+        printf("%s\n", e.what());
+    }
+    catch (...) {
+        printf("???? unknown exception\n");
+    }
+};
+
+extern "C" void vPocketGeometry(
+    int debugArg0, int debugArg1,
+    int geometry,
+    double cutterAngle, double passDepth, double maxDepth,
+    int*& resultPaths)
+{
+    resultPaths = nullptr;
+    try {
+        Geometry* g = findGeometry(geometry);
+        if (!g)
+            return;
+        PathSink sink(true);
+        vPocketPaths(debugArg0, debugArg1, g->medialAxis(), cutterAngle, passDepth, maxDepth, sink);
+        resultPaths = sink.release();
+    }
+    catch (exception& e) {
+        printf("%s\n", e.what());
+    }
+    catch (...) {
+        printf("???? unknown exception\n");
+    }
+};
+
+extern "C" void vPocketGeometryStream(
+    int debugArg0, int debugArg1,
+    int geometry,
+    double cutterAngle, double passDepth, double maxDepth,
+    PathsCallback callback, void* context)
+{
+    try {
+        Geometry* g = findGeometry(geometry);
+        if (!g)
+            return;
+        PathSink sink(callback, context, true);
+        vPocketPaths(debugArg0, debugArg1, g->medialAxis(), cutterAngle, passDepth, maxDepth, sink);
+        sink.flush();
+    }
+    catch (exception& e) {
+        printf("%s\n", e.what());
+    }
+    catch (...) {
+        printf("???? unknown exception\n");
+    }
+};
+
+extern "C" void vPocketFlatGeometry(
+    int debugArg0, int debugArg1,
+    int geometry,
+    double cutterAngle, double passDepth, double maxDepth,
+    double flatCutterDia, const double* options,
+    int*& resultPaths, int*& resultFloorPaths)
+{
+    resultPaths = nullptr;
+    resultFloorPaths = nullptr;
+    try {
+        Geometry* g = findGeometry(geometry);
+        if (!g)
+            return;
+        PathSink sink(true);
+        double deepest = vPocketPaths(debugArg0, debugArg1, g->medialAxis(), cutterAngle, passDepth, maxDepth, sink);
+        PathSink floorSink(true);
+        if (vPocketHasFloor(cutterAngle, deepest, maxDepth, flatCutterDia))
+            vPocketFloorPaths(
+                medialAxisInset(g->medialAxis(), vPocketFloorInset(cutterAngle, maxDepth, flatCutterDia), arcTolerance),
+                passDepth, maxDepth, flatCutterDia, options, floorSink);
+        unique_ptr<int, void(*)(void*)> floorPaths(floorSink.release(), free);
+        resultPaths = sink.release();
+        resultFloorPaths = floorPaths.release();
     }
     catch (exception& e) {
         printf("%s\n", e.what());
@@ -114,9 +114,49 @@ jscut.priv.cam = jscut.priv.cam || {};
         return camPaths;
     }
 
+    // Call a C++ operation whose last two arguments are int*& resultPaths and
+    // int*& resultSafeToClose. Returns array of CamPath.
+    function callCppMergedPaths(name, geometry, argTypes, args) {
+        "use strict";
+
+        var memoryBlocks = [];
+
+        var cGeometry = jscut.priv.path.convertPathsToCpp(memoryBlocks, geometry);
+        var resultPathsRef = Module._malloc(4);
+        memoryBlocks.push(resultPathsRef);
+        var resultSafeToCloseRef = Module._malloc(4);
+        memoryBlocks.push(resultSafeToCloseRef);
+
+        Module.ccall(
+            name, 'void', ['number'].concat(argTypes, ['number', 'number']),
+            [cGeometry].concat(args, [resultPathsRef, resultSafeToCloseRef]));
+
+        var result = jscut.priv.path.convertPathsFromCppToCamPath(memoryBlocks, resultPathsRef);
+        var cSafeToClose = Module.HEAPU32[resultSafeToCloseRef >> 2];
+        if (cSafeToClose) {
+            memoryBlocks.push(cSafeToClose);
+            for (var i = 0; i < result.length; ++i)
+                result[i].safeToClose = Module.HEAP32[(cSafeToClose >> 2) + i] != 0;
+        }
+
+        for (var i = 0; i < memoryBlocks.length; ++i)
+            Module._free(memoryBlocks[i]);
+
+        return result;
+    }
+
     // Compute paths for pocket operation on Clipper geometry. Returns array
     // of CamPath. cutterDia is in Clipper units. overlap is in the range [0, 1).
     jscut.priv.cam.pocket = function (geometry, cutterDia, overlap, climb) {
+        //extern "C" void pocket(
+        //    const int* paths, double cutterDia, double overlap, int climb,
+        //    int*& resultPaths, int*& resultSafeToClose)
+        if (typeof Module != 'undefined')
+            return callCppMergedPaths(
+                'pocket', geometry,
+                ['number', 'number', 'number'],
+                [cutterDia, overlap, climb ? 1 : 0]);
+
         var current = jscut.priv.path.offset(geometry, -cutterDia / 2);
         var bounds = current.slice(0);
         var allPaths = [];
@@ -130,31 +170,58 @@ jscut.priv.cam = jscut.priv.cam || {};
         return mergePaths(bounds, allPaths);
     };
 
+    // Copy hspocket options to C++. options may have startX, startY, stepover,
+    // minRadius, minProgress and rasterCellSize (Clipper units); missing ones use
+    // the defaults.
+    function convertHspocketOptionsToCpp(memoryBlocks, options) {
+        "use strict";
+
+        if (typeof options == 'undefined')
+            options = {};
+
+        // Order matches enum HspocketOption in cam.h
+        var values = [
+            options.startX,
+            options.startY,
+            options.stepover,
+            options.minRadius,
+            options.minProgress,
+            options.rasterCellSize,
+        ];
+        var cOptions = Module._malloc(values.length * 8);
+        memoryBlocks.push(cOptions);
+        for (var i = 0; i < values.length; ++i)
+            Module.HEAPF64[(cOptions >> 3) + i] = typeof values[i] == 'undefined' ? NaN : values[i];
+        return cOptions;
+    }
+
     // Compute paths for pocket operation on Clipper geometry. Returns array
     // of CamPath. cutterDia is in Clipper units. overlap is in the range [0, 1).
-    jscut.priv.cam.hspocket = function (geometry, cutterDia, overlap, climb) {
+    // options is optional; see convertHspocketOptionsToCpp. geometry may be a
+    // handle from createGeometry.
+    jscut.priv.cam.hspocket = function (geometry, cutterDia, overlap, climb, options) {
         "use strict";
 
         var memoryBlocks = [];
 
-        var cGeometry = jscut.priv.path.convertPathsToCpp(memoryBlocks, geometry);
+        var cOptions = convertHspocketOptionsToCpp(memoryBlocks, options);
 
         var resultPathsRef = Module._malloc(4);
-        var resultNumPathsRef = Module._malloc(4);
-        var resultPathSizesRef = Module._malloc(4);
         memoryBlocks.push(resultPathsRef);
-        memoryBlocks.push(resultNumPathsRef);
-        memoryBlocks.push(resultPathSizesRef);
 
         //extern "C" void hspocket(
-        //    double** paths, int numPaths, int* pathSizes, double cutterDia,
-        //    double**& resultPaths, int& resultNumPaths, int*& resultPathSizes)
+        //    const int* paths, double cutterDia, const double* options,
+        //    int*& resultPaths)
+        //extern "C" void hspocketGeometry(
+        //    int geometry, double cutterDia, const double* options,
+        //    int*& resultPaths)
+        var isHandle = typeof geometry == 'number';
         Module.ccall(
-            'hspocket',
-            'void', ['number', 'number', 'number', 'number', 'number', 'number', 'number'],
-            [cGeometry[0], cGeometry[1], cGeometry[2], cutterDia, resultPathsRef, resultNumPathsRef, resultPathSizesRef]);
+            isHandle ? 'hspocketGeometry' : 'hspocket',
+            'void', ['number', 'number', 'number', 'number'],
+            [isHandle ? geometry : jscut.priv.path.convertPathsToCpp(memoryBlocks, geometry), cutterDia, cOptions, resultPathsRef]);
 
-        var result = jscut.priv.path.convertPathsFromCppToCamPath(memoryBlocks, resultPathsRef, resultNumPathsRef, resultPathSizesRef);
+        var result = jscut.priv.path.convertPathsFromCppToCamPath(memoryBlocks, resultPathsRef);
 
         for (var i = 0; i < memoryBlocks.length; ++i)
             Module._free(memoryBlocks[i]);
@@ -162,10 +229,46 @@ jscut.priv.cam = jscut.priv.cam || {};
         return result;
     };
 
+    // Like hspocket, but passes arrays of CamPath to onPaths as they're produced
+    jscut.priv.cam.hspocketStream = function (geometry, cutterDia, overlap, climb, onPaths, options) {
+        "use strict";
+
+        var memoryBlocks = [];
+
+        var isHandle = typeof geometry == 'number';
+        var cGeometry = isHandle ? geometry : jscut.priv.path.convertPathsToCpp(memoryBlocks, geometry);
+        var cOptions = convertHspocketOptionsToCpp(memoryBlocks, options);
+
+        //extern "C" void hspocketStream(
+        //    const int* paths, double cutterDia, const double* options,
+        //    PathsCallback callback, void* context)
+        //extern "C" void hspocketGeometryStream(
+        //    int geometry, double cutterDia, const double* options,
+        //    PathsCallback callback, void* context)
+        jscut.priv.path.withCppPathsCallback(onPaths, function (callback) {
+            Module.ccall(
+                isHandle ? 'hspocketGeometryStream' : 'hspocketStream',
+                'void', ['number', 'number', 'number', 'number', 'number'],
+                [cGeometry, cutterDia, cOptions, callback, 0]);
+        });
+
+        for (var i = 0; i < memoryBlocks.length; ++i)
+            Module._free(memoryBlocks[i]);
+    };
+
     // Compute paths for outline operation on Clipper geometry. Returns array
     // of CamPath. cutterDia and width are in Clipper units. overlap is in the 
     // range [0, 1).
     jscut.priv.cam.outline = function (geometry, cutterDia, isInside, width, overlap, climb) {
+        //extern "C" void outline(
+        //    const int* paths, double cutterDia, int isInside, double width, double overlap, int climb,
+        //    int*& resultPaths, int*& resultSafeToClose)
+        if (typeof Module != 'undefined')
+            return callCppMergedPaths(
+                'outline', geometry,
+                ['number', 'number', 'number', 'number', 'number'],
+                [cutterDia, isInside ? 1 : 0, width, overlap, climb ? 1 : 0]);
+
         var currentWidth = cutterDia;
         var allPaths = [];
         var eachWidth = cutterDia * (1 - overlap);
@@ -224,6 +327,46 @@ jscut.priv.cam = jscut.priv.cam || {};
         return result;
     };
 
+    // Copy Clipper geometry to C++ and return a handle for the *Geometry entry
+    // points, or 0 if it fails. Call destroyGeometry when done with it.
+    jscut.priv.cam.createGeometry = function (geometry) {
+        "use strict";
+
+        var memoryBlocks = [];
+        var cGeometry = jscut.priv.path.convertPathsToCpp(memoryBlocks, geometry);
+
+        //extern "C" int createGeometry(const int* paths)
+        var handle = Module.ccall('createGeometry', 'number', ['number'], [cGeometry]);
+
+        for (var i = 0; i < memoryBlocks.length; ++i)
+            Module._free(memoryBlocks[i]);
+
+        return handle;
+    };
+
+    // Replace a handle's geometry
+    jscut.priv.cam.updateGeometry = function (handle, geometry) {
+        "use strict";
+
+        var memoryBlocks = [];
+        var cGeometry = jscut.priv.path.convertPathsToCpp(memoryBlocks, geometry);
+
+        //extern "C" void setGeometry(int geometry, const int* paths)
+        Module.ccall('setGeometry', 'void', ['number', 'number'], [handle, cGeometry]);
+
+        for (var i = 0; i < memoryBlocks.length; ++i)
+            Module._free(memoryBlocks[i]);
+    };
+
+    jscut.priv.cam.destroyGeometry = function (handle) {
+        "use strict";
+
+        //extern "C" void destroyGeometry(int geometry)
+        Module.ccall('destroyGeometry', 'void', ['number'], [handle]);
+    };
+
+    // geometry may be a handle from createGeometry; that keeps the Voronoi
+    // diagram between calls.
     jscut.priv.cam.vPocket = function (geometry, cutterAngle, passDepth, maxDepth) {
         "use strict";
 
@@ -232,26 +375,97 @@ jscut.priv.cam = jscut.priv.cam || {};
 
         var memoryBlocks = [];
 
-        var cGeometry = jscut.priv.path.convertPathsToCpp(memoryBlocks, geometry);
+        var isHandle = typeof geometry == 'number';
+        var cGeometry = isHandle ? geometry : jscut.priv.path.convertPathsToCpp(memoryBlocks, geometry);
 
         var resultPathsRef = Module._malloc(4);
-        var resultNumPathsRef = Module._malloc(4);
-        var resultPathSizesRef = Module._malloc(4);
         memoryBlocks.push(resultPathsRef);
-        memoryBlocks.push(resultNumPathsRef);
-        memoryBlocks.push(resultPathSizesRef);
 
         //extern "C" void vPocket(
         //    int debugArg0, int debugArg1,
-        //    double** paths, int numPaths, int* pathSizes,
+        //    const int* paths,
         //    double cutterAngle, double passDepth, double maxDepth,
-        //    double**& resultPaths, int& resultNumPaths, int*& resultPathSizes)
+        //    int*& resultPaths)
+        //extern "C" void vPocketGeometry(..., int geometry, ...)
         Module.ccall(
-            'vPocket',
-            'void', ['number', 'number', 'number', 'number', 'number', 'number', 'number', 'number', 'number', 'number', 'number'],
-            [miscViewModel.debugArg0(), miscViewModel.debugArg1(), cGeometry[0], cGeometry[1], cGeometry[2], cutterAngle, passDepth, maxDepth, resultPathsRef, resultNumPathsRef, resultPathSizesRef]);
+            isHandle ? 'vPocketGeometry' : 'vPocket',
+            'void', ['number', 'number', 'number', 'number', 'number', 'number', 'number'],
+            [miscViewModel.debugArg0(), miscViewModel.debugArg1(), cGeometry, cutterAngle, passDepth, maxDepth, resultPathsRef]);
 
-        var result = jscut.priv.path.convertPathsFromCppToCamPath(memoryBlocks, resultPathsRef, resultNumPathsRef, resultPathSizesRef);
+        var result = jscut.priv.path.convertPathsFromCppToCamPath(memoryBlocks, resultPathsRef);
+
+        for (var i = 0; i < memoryBlocks.length; ++i)
+            Module._free(memoryBlocks[i]);
+
+        return result;
+    };
+
+    // Like vPocket, but passes arrays of CamPath to onPaths as they're produced
+    jscut.priv.cam.vPocketStream = function (geometry, cutterAngle, passDepth, maxDepth, onPaths) {
+        "use strict";
+
+        if (cutterAngle <= 0 || cutterAngle >= 180)
+            return;
+
+        var memoryBlocks = [];
+
+        var isHandle = typeof geometry == 'number';
+        var cGeometry = isHandle ? geometry : jscut.priv.path.convertPathsToCpp(memoryBlocks, geometry);
+
+        //extern "C" void vPocketStream(
+        //    int debugArg0, int debugArg1,
+        //    const int* paths,
+        //    double cutterAngle, double passDepth, double maxDepth,
+        //    PathsCallback callback, void* context)
+        //extern "C" void vPocketGeometryStream(..., int geometry, ...)
+        jscut.priv.path.withCppPathsCallback(onPaths, function (callback) {
+            Module.ccall(
+                isHandle ? 'vPocketGeometryStream' : 'vPocketStream',
+                'void', ['number', 'number', 'number', 'number', 'number', 'number', 'number', 'number'],
+                [miscViewModel.debugArg0(), miscViewModel.debugArg1(), cGeometry, cutterAngle, passDepth, maxDepth, callback, 0]);
+        });
+
+        for (var i = 0; i < memoryBlocks.length; ++i)
+            Module._free(memoryBlocks[i]);
+    };
+
+    // Flat-bottom V-carve. Returns { paths, floorPaths }, arrays of CamPath:
+    // paths for the V cutter, which stop at maxDepth, and floorPaths for a flat
+    // cutter of flatCutterDia which clears where the carve would go deeper.
+    // options is as for hspocket. geometry may be a handle from createGeometry.
+    jscut.priv.cam.vPocketFlat = function (geometry, cutterAngle, passDepth, maxDepth, flatCutterDia, options) {
+        "use strict";
+
+        if (cutterAngle <= 0 || cutterAngle >= 180)
+            return { paths: [], floorPaths: [] };
+
+        var memoryBlocks = [];
+
+        var isHandle = typeof geometry == 'number';
+        var cGeometry = isHandle ? geometry : jscut.priv.path.convertPathsToCpp(memoryBlocks, geometry);
+        var cOptions = convertHspocketOptionsToCpp(memoryBlocks, options);
+
+        var resultPathsRef = Module._malloc(4);
+        memoryBlocks.push(resultPathsRef);
+        var resultFloorPathsRef = Module._malloc(4);
+        memoryBlocks.push(resultFloorPathsRef);
+
+        //extern "C" void vPocketFlat(
+        //    int debugArg0, int debugArg1,
+        //    const int* paths,
+        //    double cutterAngle, double passDepth, double maxDepth,
+        //    double flatCutterDia, const double* options,
+        //    int*& resultPaths, int*& resultFloorPaths)
+        //extern "C" void vPocketFlatGeometry(..., int geometry, ...)
+        Module.ccall(
+            isHandle ? 'vPocketFlatGeometry' : 'vPocketFlat',
+            'void', ['number', 'number', 'number', 'number', 'number', 'number', 'number', 'number', 'number', 'number'],
+            [miscViewModel.debugArg0(), miscViewModel.debugArg1(), cGeometry, cutterAngle, passDepth, maxDepth, flatCutterDia, cOptions, resultPathsRef, resultFloorPathsRef]);
+
+        var result = {
+            paths: jscut.priv.path.convertPathsFromCppToCamPath(memoryBlocks, resultPathsRef),
+            floorPaths: jscut.priv.path.convertPathsFromCppToCamPath(memoryBlocks, resultFloorPathsRef),
+        };
 
         for (var i = 0; i < memoryBlocks.length; ++i)
             Module._free(memoryBlocks[i]);
@@ -291,29 +505,24 @@ jscut.priv.cam = jscut.priv.cam || {};
 
         var errorRef = Module._malloc(4);
         var resultPathsRef = Module._malloc(4);
-        var resultNumPathsRef = Module._malloc(4);
-        var resultPathSizesRef = Module._malloc(4);
         memoryBlocks.push(errorRef);
         memoryBlocks.push(resultPathsRef);
-        memoryBlocks.push(resultNumPathsRef);
-        memoryBlocks.push(resultPathSizesRef);
 
         //extern "C" void separateTabs(
-        //    double** pathPolygons, int numPaths, int* pathSizes,
-        //    double** tabPolygons, int numTabPolygons, int* tabPolygonSizes,
-        //    bool& error,
-        //    double**& resultPaths, int& resultNumPaths, int*& resultPathSizes)
+        //    const int* pathPolygons, const int* tabPolygons,
+        //    int& error,
+        //    int*& resultPaths)
         Module.ccall(
             'separateTabs',
-            'void', ['number', 'number', 'number', 'number', 'number', 'number', 'number', 'number', 'number', 'number'],
-            [cCutterPath[0], cCutterPath[1], cCutterPath[2], cTabGeometry[0], cTabGeometry[1], cTabGeometry[2], errorRef, resultPathsRef, resultNumPathsRef, resultPathSizesRef]);
+            'void', ['number', 'number', 'number', 'number'],
+            [cCutterPath, cTabGeometry, errorRef, resultPathsRef]);
 
         if (Module.HEAPU32[errorRef >> 2] && !displayedCppTabError2) {
             showAlert("Internal error processing tabs; tabs will be missing. This message will not repeat.", "alert-danger", false);
             displayedCppTabError2 = true;
         }
 
-        var result = jscut.priv.path.convertPathsFromCpp(memoryBlocks, resultPathsRef, resultNumPathsRef, resultPathSizesRef);
+        var result = jscut.priv.path.convertPathsFromCpp(memoryBlocks, resultPathsRef);
 
         for (var i = 0; i < memoryBlocks.length; ++i)
             Module._free(memoryBlocks[i]);
@@ -321,6 +530,87 @@ jscut.priv.cam = jscut.priv.cam || {};
         return result;
     }
 
+    // getGcode() using the C++ writer (cpp/gcode.cpp). Same output.
+    function getGcodeCpp(namedArgs) {
+        "use strict";
+
+        var paths = namedArgs.paths;
+        var tabGeometry = namedArgs.tabGeometry;
+        if (typeof tabGeometry == 'undefined')
+            tabGeometry = [];
+
+        var memoryBlocks = [];
+
+        var cPaths = jscut.priv.path.convertPathsToCpp(
+            memoryBlocks, jscut.priv.cam.getClipperPathsFromCamPaths(paths), true);
+        var cTabGeometry = jscut.priv.path.convertPathsToCpp(memoryBlocks, tabGeometry);
+
+        var cSafeToClose = Module._malloc(Math.max(paths.length, 1) * 4);
+        memoryBlocks.push(cSafeToClose);
+        for (var i = 0; i < paths.length; ++i)
+            Module.HEAP32[(cSafeToClose >> 2) + i] = paths[i].safeToClose ? 1 : 0;
+
+        // Order matches enum GcodeOption in cam.h
+        var options = [
+            namedArgs.ramp ? 1 : 0,
+            namedArgs.scale,
+            namedArgs.useZ ? 1 : 0,
+            namedArgs.offsetX,
+            namedArgs.offsetY,
+            namedArgs.decimal,
+            namedArgs.topZ,
+            namedArgs.botZ,
+            namedArgs.safeZ,
+            namedArgs.passDepth,
+            namedArgs.plungeFeed,
+            namedArgs.retractFeed,
+            namedArgs.cutFeed,
+            namedArgs.rapidFeed,
+            typeof namedArgs.tabZ == 'undefined' ? namedArgs.botZ : namedArgs.tabZ,
+        ];
+        var cOptions = Module._malloc(options.length * 8);
+        memoryBlocks.push(cOptions);
+        for (var i = 0; i < options.length; ++i)
+            Module.HEAPF64[(cOptions >> 3) + i] = options[i];
+
+        var tabErrorRef = Module._malloc(4);
+        var resultRef = Module._malloc(4);
+        var resultSizeRef = Module._malloc(4);
+        memoryBlocks.push(tabErrorRef);
+        memoryBlocks.push(resultRef);
+        memoryBlocks.push(resultSizeRef);
+
+        //extern "C" void getGcode(
+        //    const int* paths, const int* safeToClose, const int* tabGeometry,
+        //    const double* options,
+        //    int& tabError,
+        //    char*& result, int& resultSize)
+        Module.ccall(
+            'getGcode',
+            'void', ['number', 'number', 'number', 'number', 'number', 'number', 'number'],
+            [cPaths, cSafeToClose, cTabGeometry, cOptions, tabErrorRef, resultRef, resultSizeRef]);
+
+        if (Module.HEAPU32[tabErrorRef >> 2] && !displayedCppTabError2) {
+            showAlert("Internal error processing tabs; tabs will be missing. This message will not repeat.", "alert-danger", false);
+            displayedCppTabError2 = true;
+        }
+
+        var result = Module.HEAPU32[resultRef >> 2];
+        var resultSize = Module.HEAP32[resultSizeRef >> 2];
+        var gcode = "";
+        if (result) {
+            memoryBlocks.push(result);
+            // gcode is ASCII. Convert in chunks to stay under the argument count limit.
+            for (var pos = 0; pos < resultSize; pos += 0x8000)
+                gcode += String.fromCharCode.apply(null, Module.HEAPU8.subarray(result + pos, result + Math.min(pos + 0x8000, resultSize)));
+        }
+
+        for (var i = 0; i < memoryBlocks.length; ++i)
+            Module._free(memoryBlocks[i]);
+
+        return gcode;
+    }
+
     // Convert paths to gcode. getGcode() assumes that the current Z position is at safeZ.
     // getGcode()'s gcode returns Z to this position at the end.
     // namedArgs must have:
@@ -342,6 +632,9 @@ jscut.priv.cam = jscut.priv.cam || {};
     //      tabGeometry:    Tab geometry (optional)
     //      tabZ:           Z position over tabs (required if tabGeometry is not empty) (gcode units)
     jscut.priv.cam.getGcode = function (namedArgs) {
+        if (typeof Module != 'undefined')
+            return getGcodeCpp(namedArgs);
+
         var paths = namedArgs.paths;
         var ramp = namedArgs.ramp;
         var scale = namedArgs.scale;
@@ -115,6 +115,12 @@ function Operation(miscViewModel, options, svgViewModel, materialViewModel, oper
     self.toolPaths = ko.observable([]);
     self.toolPathSvg = null;
 
+    // C++ copy of the offset geometry (jscut.priv.cam.createGeometry), so
+    // regenerating with other tool settings reuses what it built last time
+    var cppGeometry = 0;
+    var cppGeometrySource = null;
+    var cppGeometryOffset = 0;
+
     self.unitConverter.add(self.cutDepth);
     self.unitConverter.add(self.margin);
     self.unitConverter.add(self.width);
@@ -132,6 +138,26 @@ function Operation(miscViewModel, options, svgViewModel, materialViewModel, oper
         }
     }
 
+    self.destroyCppGeometry = function () {
+        if (cppGeometry) {
+            jscut.priv.cam.destroyGeometry(cppGeometry);
+            cppGeometry = 0;
+            cppGeometrySource = null;
+        }
+    }
+
+    function getCppGeometry(geometry, offset) {
+        if (cppGeometry && cppGeometrySource === self.combinedGeometry && cppGeometryOffset == offset)
+            return cppGeometry;
+        if (cppGeometry)
+            jscut.priv.cam.updateGeometry(cppGeometry, geometry);
+        else
+            cppGeometry = jscut.priv.cam.createGeometry(geometry);
+        cppGeometrySource = cppGeometry ? self.combinedGeometry : null;
+        cppGeometryOffset = offset;
+        return cppGeometry || geometry;
+    }
+
     self.removeToolPaths = function() {
         if (self.toolPathSvg) {
             self.toolPathSvg.remove();
@@ -259,7 +285,7 @@ function Operation(miscViewModel, options, svgViewModel, materialViewModel, oper
         if (self.camOp() == "Pocket")
             self.toolPaths(jscut.priv.cam.pocket(geometry, toolCamArgs.diameterClipper, 1 - toolCamArgs.stepover, self.direction() == "Climb"));
         else if (self.camOp() == "V Pocket")
-            self.toolPaths(jscut.priv.cam.vPocket(geometry, toolModel.angle(), toolCamArgs.passDepthClipper, self.cutDepth.toInch() * jscut.priv.path.inchToClipperScale, toolCamArgs.stepover, self.direction() == "Climb"));
+            self.toolPaths(jscut.priv.cam.vPocket(getCppGeometry(geometry, offset), toolModel.angle(), toolCamArgs.passDepthClipper, self.cutDepth.toInch() * jscut.priv.path.inchToClipperScale, toolCamArgs.stepover, self.direction() == "Climb"));
         else if (self.camOp() == "Inside" || self.camOp() == "Outside") {
             var width = self.width.toInch() * jscut.priv.path.inchToClipperScale;
             if (width < toolCamArgs.diameterClipper)
@@ -441,6 +467,7 @@ function OperationsViewModel(miscViewModel, options, svgViewModel, materialViewM
     self.removeOperation = function (operation) {
         operation.removeCombinedGeometrySvg();
         operation.removeToolPaths();
+        operation.destroyCppGeometry();
         var i = self.operations.indexOf(operation);
         self.operations.remove(operation);
     }
@@ -467,6 +494,7 @@ function OperationsViewModel(miscViewModel, options, svgViewModel, materialViewM
             for (var i = 0; i < oldOps.length; ++i) {
                 oldOps[i].removeCombinedGeometrySvg();
                 oldOps[i].removeToolPaths();
+                oldOps[i].destroyCppGeometry();
             }
 
             self.operations.removeAll();
@@ -184,112 +184,123 @@ jscut.priv.path = jscut.priv.path || {};
         return result;
     };
 
-    // Convert Clipper paths to C format. Returns [double** cPaths, int cNumPaths, int* cPathSizes].
-    jscut.priv.path.convertPathsToCpp = function(memoryBlocks, paths) {
-        var doubleSize = 8;
-
-        var cPaths = Module._malloc(paths.length * 4);
+    // Convert Clipper paths to the flat C format (FlatPaths in cam.h). Returns int* block.
+    // Includes the points' Z (0 if missing) if includeZ is set.
+    jscut.priv.path.convertPathsToCpp = function(memoryBlocks, paths, includeZ) {
+        var numPoints = 0;
+        for (var i = 0; i < paths.length; ++i)
+            numPoints += paths[i].length;
+
+        var size = 2 + paths.length + 1 + numPoints * (includeZ ? 3 : 2);
+        var cPaths = Module._malloc(size * 4);
         memoryBlocks.push(cPaths);
-        var cPathsBase = cPaths >> 2;
-
-        var cPathSizes = Module._malloc(paths.length * 4);
-        memoryBlocks.push(cPathSizes);
-        var cPathSizesBase = cPathSizes >> 2;
+        var flat = Module.HEAP32.subarray(cPaths >> 2, (cPaths >> 2) + size);
 
+        flat[0] = paths.length;
+        flat[1] = includeZ ? 1 : 0;
+        var coords = 2 + paths.length + 1;
+        var z = coords + numPoints * 2;
+        var pos = 0;
         for (var i = 0; i < paths.length; ++i) {
             var path = paths[i];
-
-            var cPath = Module._malloc(path.length * 2 * doubleSize + 4);
-            memoryBlocks.push(cPath);
-            if (cPath & 4)
-                cPath += 4;
-            //console.log("-> " + cPath.toString(16));
-            var pathArray = new Float64Array(Module.HEAPU32.buffer, Module.HEAPU32.byteOffset + cPath);
-
+            flat[2 + i] = pos;
             for (var j = 0; j < path.length; ++j) {
                 var point = path[j];
-                pathArray[j * 2] = point.X;
-                pathArray[j * 2 + 1] = point.Y;
+                flat[coords + pos * 2] = point.X;
+                flat[coords + pos * 2 + 1] = point.Y;
+                if (includeZ)
+                    flat[z + pos] = point.Z || 0;
+                ++pos;
             }
-
-            Module.HEAPU32[cPathsBase + i] = cPath;
-            Module.HEAPU32[cPathSizesBase + i] = path.length;
         }
+        flat[2 + paths.length] = pos;
 
-        return [cPaths, paths.length, cPathSizes];
+        return cPaths;
     }
 
-    // Convert C format paths to Clipper paths. double**& cPathsRef, int& cNumPathsRef, int*& cPathSizesRef
-    // This version assume each point has X, Y (stride = 2).
-    jscut.priv.path.convertPathsFromCpp = function (memoryBlocks, cPathsRef, cNumPathsRef, cPathSizesRef) {
+    // View of a flat C format block: { numPaths, offsets, coords, z }. z is null if
+    // the block has no Z. The arrays view the heap directly; don't keep them past
+    // freeing the block.
+    jscut.priv.path.viewCppPaths = function (cPaths) {
+        var base = cPaths >> 2;
+        var numPaths = Module.HEAP32[base];
+        var hasZ = Module.HEAP32[base + 1];
+        var offsets = Module.HEAP32.subarray(base + 2, base + 2 + numPaths + 1);
+        var numPoints = offsets[numPaths];
+        var coordsBase = base + 2 + numPaths + 1;
+        return {
+            numPaths: numPaths,
+            offsets: offsets,
+            coords: Module.HEAP32.subarray(coordsBase, coordsBase + numPoints * 2),
+            z: hasZ ? Module.HEAP32.subarray(coordsBase + numPoints * 2, coordsBase + numPoints * 3) : null,
+        };
+    }
+
+    // Convert flat C format paths to Clipper paths. int*& cPathsRef
+    jscut.priv.path.convertPathsFromCpp = function (memoryBlocks, cPathsRef) {
         var cPaths = Module.HEAPU32[cPathsRef >> 2];
+        if (!cPaths)
+            return [];
         memoryBlocks.push(cPaths);
-        var cPathsBase = cPaths >> 2;
-
-        var cNumPaths = Module.HEAPU32[cNumPathsRef >> 2];
-
-        var cPathSizes = Module.HEAPU32[cPathSizesRef >> 2];
-        memoryBlocks.push(cPathSizes);
-        var cPathSizesBase = cPathSizes >> 2;
 
+        var flat = jscut.priv.path.viewCppPaths(cPaths);
         var convertedPaths = [];
-        for (var i = 0; i < cNumPaths; ++i) {
-            var pathSize = Module.HEAPU32[cPathSizesBase + i];
-            var cPath = Module.HEAPU32[cPathsBase + i];
-            // cPath contains value to pass to Module._free(). The aligned version contains the actual data.
-            memoryBlocks.push(cPath);
-            if (cPath & 4)
-                cPath += 4;
-            var pathArray = new Float64Array(Module.HEAPU32.buffer, Module.HEAPU32.byteOffset + cPath);
-
+        for (var i = 0; i < flat.numPaths; ++i) {
             var convertedPath = [];
             convertedPaths.push(convertedPath);
-            for (var j = 0; j < pathSize; ++j)
+            for (var j = flat.offsets[i]; j < flat.offsets[i + 1]; ++j)
                 convertedPath.push({
-                    X: pathArray[j * 2],
-                    Y: pathArray[j * 2 + 1]
+                    X: flat.coords[j * 2],
+                    Y: flat.coords[j * 2 + 1]
                 });
         }
 
         return convertedPaths;
     }
 
-    // Convert C format paths to array of CamPath. double**& cPathsRef, int& cNumPathsRef, int*& cPathSizesRef
-    // This version assume each point has X, Y, Z (stride = 3).
-    jscut.priv.path.convertPathsFromCppToCamPath = function (memoryBlocks, cPathsRef, cNumPathsRef, cPathSizesRef) {
+    // Convert flat C format paths to array of CamPath. int*& cPathsRef. Z is 0 if the
+    // block has no Z.
+    jscut.priv.path.convertPathsFromCppToCamPath = function (memoryBlocks, cPathsRef) {
         var cPaths = Module.HEAPU32[cPathsRef >> 2];
+        if (!cPaths)
+            return [];
         memoryBlocks.push(cPaths);
-        var cPathsBase = cPaths >> 2;
-
-        var cNumPaths = Module.HEAPU32[cNumPathsRef >> 2];
-
-        var cPathSizes = Module.HEAPU32[cPathSizesRef >> 2];
-        memoryBlocks.push(cPathSizes);
-        var cPathSizesBase = cPathSizes >> 2;
 
+        var flat = jscut.priv.path.viewCppPaths(cPaths);
         var convertedPaths = [];
-        for (var i = 0; i < cNumPaths; ++i) {
-            var pathSize = Module.HEAPU32[cPathSizesBase + i];
-            var cPath = Module.HEAPU32[cPathsBase + i];
-            // cPath contains value to pass to Module._free(). The aligned version contains the actual data.
-            memoryBlocks.push(cPath);
-            if (cPath & 4)
-                cPath += 4;
-            var pathArray = new Float64Array(Module.HEAPU32.buffer, Module.HEAPU32.byteOffset + cPath);
-
+        for (var i = 0; i < flat.numPaths; ++i) {
             var convertedPath = [];
             convertedPaths.push({ path: convertedPath, safeToClose: false });
-            for (var j = 0; j < pathSize; ++j)
+            for (var j = flat.offsets[i]; j < flat.offsets[i + 1]; ++j)
                 convertedPath.push({
-                    X: pathArray[j * 3],
-                    Y: pathArray[j * 3 + 1],
-                    Z: pathArray[j * 3 + 2],
+                    X: flat.coords[j * 2],
+                    Y: flat.coords[j * 2 + 1],
+                    Z: flat.z ? flat.z[j] : 0,
                 });
         }
 
         return convertedPaths;
     }
 
+    // Call f(callbackPtr) with a C PathsCallback which converts each chunk of paths to
+    // an array of CamPath and passes it to onPaths. The chunk views are only valid
+    // during the callback, so they're converted right away.
+    jscut.priv.path.withCppPathsCallback = function (onPaths, f) {
+        var callbackPtr = Runtime.addFunction(function (context, cPaths) {
+            var memoryBlocks = [];
+            var ref = Module._malloc(4);
+            Module.HEAPU32[ref >> 2] = cPaths;
+            var paths = jscut.priv.path.convertPathsFromCppToCamPath(memoryBlocks, ref);
+            Module._free(ref);
+            onPaths(paths);
+        });
+        try {
+            f(callbackPtr);
+        } finally {
+            Runtime.removeFunction(callbackPtr);
+        }
+    }
+
     // Simplify and clean up Clipper geometry. fillRule is ClipperLib.PolyFillType.
     jscut.priv.path.simplifyAndClean = function (geometry, fillRule) {
         geometry = ClipperLib.Clipper.CleanPolygons(geometry, jscut.priv.path.cleanPolyDist);